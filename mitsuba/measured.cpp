@@ -21,7 +21,9 @@ public:
         fs::path filename = Thread::getThread()->getFileResolver()->resolve(
             props.getString("filename"));
 
-        m_brdf = new powitacq_rgb::BRDF(filename.string().c_str());
+        /* Instances referencing the same file share a single copy of the tables */
+        m_brdf = new powitacq_rgb::BRDF(
+            powitacq_rgb::Registry::instance().load(filename.string()));
     }
 
     Measured(Stream *stream, InstanceManager *manager)
@@ -89,37 +91,94 @@ private:
 };
 
 // ================ Hardware shader implementation ================
+
+/**
+ * Renders the analytic proxy of the measured material (a diffuse lobe and an
+ * anisotropic GGX lobe), see \ref powitacq_rgb::Proxy
+ */
 class MeasuredShader : public Shader {
 public:
-    MeasuredShader(Renderer *renderer)
+    MeasuredShader(Renderer *renderer, const powitacq_rgb::Proxy &proxy)
         : Shader(renderer, EBSDFShader) {
+        m_diffuse = Color3(proxy.diffuse[0], proxy.diffuse[1], proxy.diffuse[2]);
+        m_specular = Color3(proxy.specular[0], proxy.specular[1], proxy.specular[2]);
+        m_alphaU = proxy.alpha_u;
+        m_alphaV = proxy.alpha_v;
     }
 
     bool isComplete() const { return true; }
     void cleanup(Renderer *renderer) {}
     void putDependencies(std::vector<Shader *> &deps) { }
 
+    void resolve(const GPUProgram *program, const std::string &evalName,
+            std::vector<int> &parameterIDs) const {
+        parameterIDs.push_back(program->getParameterID(evalName + "_diffuseReflectance", false));
+        parameterIDs.push_back(program->getParameterID(evalName + "_specularReflectance", false));
+        parameterIDs.push_back(program->getParameterID(evalName + "_alphaU", false));
+        parameterIDs.push_back(program->getParameterID(evalName + "_alphaV", false));
+    }
+
+    void bind(GPUProgram *program, const std::vector<int> &parameterIDs,
+            int &textureUnitOffset) const {
+        program->setParameter(parameterIDs[0], m_diffuse);
+        program->setParameter(parameterIDs[1], m_specular);
+        program->setParameter(parameterIDs[2], m_alphaU);
+        program->setParameter(parameterIDs[3], m_alphaV);
+    }
+
     void generateCode(std::ostringstream &oss,
             const std::string &evalName,
             const std::vector<std::string> &depNames) const {
-        oss << "vec3 " << evalName << "(vec2 uv, vec3 wi, vec3 wo) {" << endl
-            << "    if (cosTheta(wi) < 0.0 || cosTheta(wo) < 0.0)" << endl
+        oss << "uniform vec3 " << evalName << "_diffuseReflectance;" << endl
+            << "uniform vec3 " << evalName << "_specularReflectance;" << endl
+            << "uniform float " << evalName << "_alphaU;" << endl
+            << "uniform float " << evalName << "_alphaV;" << endl
+            << endl
+            << "float " << evalName << "_D(vec3 m) {" << endl
+            << "    if (cosTheta(m) <= 0.0)" << endl
+            << "        return 0.0;" << endl
+            << "    float d = m.x * m.x / (" << evalName << "_alphaU * " << evalName << "_alphaU)" << endl
+            << "            + m.y * m.y / (" << evalName << "_alphaV * " << evalName << "_alphaV)" << endl
+            << "            + m.z * m.z;" << endl
+            << "    return inv_pi / (" << evalName << "_alphaU * " << evalName << "_alphaV * d * d);" << endl
+            << "}" << endl
+            << endl
+            << "float " << evalName << "_G1(vec3 v, vec3 m) {" << endl
+            << "    if (dot(v, m) <= 0.0 || cosTheta(v) <= 0.0)" << endl
+            << "        return 0.0;" << endl
+            << "    float ax = " << evalName << "_alphaU * v.x, ay = " << evalName << "_alphaV * v.y;" << endl
+            << "    float tan2 = (ax * ax + ay * ay) / (v.z * v.z);" << endl
+            << "    return 2.0 / (1.0 + sqrt(1.0 + tan2));" << endl
+            << "}" << endl
+            << endl
+            << "vec3 " << evalName << "(vec2 uv, vec3 wi, vec3 wo) {" << endl
+            << "    if (cosTheta(wi) <= 0.0 || cosTheta(wo) <= 0.0)" << endl
             << "        return vec3(0.0);" << endl
-            << "    return vec3(inv_pi * cosTheta(wo));" << endl
+            << "    vec3 H = normalize(wi + wo);" << endl
+            << "    float spec = " << evalName << "_D(H) * " << evalName << "_G1(wi, H)" << endl
+            << "        * " << evalName << "_G1(wo, H) / (4.0 * cosTheta(wi));" << endl
+            << "    return " << evalName << "_diffuseReflectance * (inv_pi * cosTheta(wo))" << endl
+            << "        + " << evalName << "_specularReflectance * spec;" << endl
             << "}" << endl
             << endl
             << "vec3 " << evalName << "_diffuse(vec2 uv, vec3 wi, vec3 wo) {" << endl
-            << "    return " << evalName << "(uv, wi, wo);" << endl
+            << "    if (cosTheta(wi) <= 0.0 || cosTheta(wo) <= 0.0)" << endl
+            << "        return vec3(0.0);" << endl
+            << "    return " << evalName << "_diffuseReflectance * (inv_pi * cosTheta(wo));" << endl
             << "}" << endl;
     }
 
     MTS_DECLARE_CLASS()
 private:
-    ref<Shader> m_reflectanceShader;
+    Spectrum m_diffuse;
+    Spectrum m_specular;
+    Float m_alphaU;
+    Float m_alphaV;
 };
 
 Shader *Measured::createShader(Renderer *renderer) const {
-    return new MeasuredShader(renderer);
+    /* The analytic proxy is fitted the first time it is requested */
+    return new MeasuredShader(renderer, m_brdf->proxy());
 }
 
 MTS_IMPLEMENT_CLASS(MeasuredShader, false, Shader)
@@ -18,13 +18,15 @@
    inefficiencies that should be removed in a
    "production" setting.
 
-   1. It returns the full captured spectrum using a
-      std::valarray, which causes dynamic
-      memory allocation at every BRDF evaluation.
+   1. The spectral version returns the full captured
+      spectrum using a std::valarray, which causes
+      dynamic memory allocation at every BRDF evaluation.
 
       In practice, the rendering system may only want
       to evaluate a fixed subset of the wavelengths,
-      which could furthermore be stored on the stack.
+      which could furthermore be stored on the stack
+      (as done by BRDFs with a constant number of
+      channels, e.g. the RGB version in powitacq_rgb.h).
 
    2. The implementation doesn't rely on vectorization
       to accelerate simultaneous evaluation at multiple
@@ -40,6 +42,8 @@
 #include <array>
 #include <valarray>
 #include <unordered_map>
+#include <future>
+#include <type_traits>
 
 /* Helper functions if C++11 is used instead of C++14 */
 #if __cplusplus < 201402L
@@ -52,8 +56,12 @@ using make_signed_t = typename make_signed<T>::type;
 }
 #endif
 
-#define POWITACQ_NAMESPACE_BEGIN  namespace powitacq {
-#define POWITACQ_NAMESPACE_END    }
+/* The namespace can be overridden, e.g. to compile a second copy of the
+   implementation with different settings into the same program */
+#if !defined(POWITACQ_NAMESPACE_BEGIN)
+#  define POWITACQ_NAMESPACE_BEGIN  namespace powitacq {
+#  define POWITACQ_NAMESPACE_END    }
+#endif
 #define POWITACQ_DIM(V)           template <size_t D = Dim, std::enable_if_t<(D >= V), int> = 0>
 
 POWITACQ_NAMESPACE_BEGIN
@@ -99,42 +107,690 @@ template <typename Type, size_t Dim> struct Vector {
 using Vector2f = Vector<float, 2>;
 using Vector3f = Vector<float, 3>;
 
+/**
+ * Alignment (in bytes) of all tabulated data and tensor fields in memory. The
+ * start of each table coincides with a cache line, which permits aligned
+ * vector loads.
+ */
+static constexpr size_t Alignment = 64;
+
+/**
+ * \brief Source of the memory that holds the tabulated data
+ *
+ * Set \c LoadOptions::memory_resource to place the tables of a material in
+ * memory provided by the application. Returned blocks must be aligned to at
+ * least \c Alignment bytes.
+ */
+class MemoryResource {
+public:
+    virtual ~MemoryResource() = default;
+
+    /// Allocate a block of \c size bytes
+    virtual void *allocate(size_t size) = 0;
+
+    /// Release a block of \c size bytes that was returned by \c allocate()
+    virtual void deallocate(void *ptr, size_t size) = 0;
+};
+
+/**
+ * \brief Memory resource that backs large tables with huge pages (Linux only)
+ *
+ * The tables are accessed at random, hence regular 4 KiB pages cause frequent
+ * TLB misses for large materials. Blocks of at least \c threshold bytes are
+ * mapped using explicit huge pages (MAP_HUGETLB) in the \c Explicit mode if
+ * the system has reserved enough of them. Otherwise, and in the \c Transparent
+ * mode, they are huge page-aligned anonymous mappings that are marked with
+ * madvise(MADV_HUGEPAGE) so that the kernel can back them with transparent
+ * huge pages. Their size is rounded up to a multiple of the huge page size.
+ * Smaller blocks, and all blocks on other platforms, use regular aligned heap
+ * memory.
+ */
+class HugePageResource : public MemoryResource {
+    struct Data;
+    std::unique_ptr<Data> m_data;
+public:
+    enum Mode { Transparent, Explicit };
+
+    HugePageResource(Mode mode = Transparent, size_t threshold = 2 * 1024 * 1024);
+    ~HugePageResource();
+
+    void *allocate(size_t size) override;
+    void deallocate(void *ptr, size_t size) override;
+
+    /// Return the number of bytes that are currently allocated
+    size_t allocated_bytes() const;
+
+    /**
+     * Return the number of allocated bytes that currently reside in huge
+     * pages. Transparent huge pages are assigned by the kernel, hence their
+     * share is determined from its accounting in /proc/self/smaps.
+     */
+    size_t huge_page_bytes() const;
+};
+
 // *****************************************************************************
 // BRDF API
 
 /// Data type used to represent spectra
 using Spectrum = std::valarray<float>;
 
-class BRDF {
+/// Channel count of BRDFs whose number of channels is only known at runtime
+static constexpr size_t Dynamic = 0;
+
+/**
+ * Type used to represent the values of a BRDF with the given number of
+ * channels: a fixed-size vector stored on the stack for constant channel
+ * counts, and a \c Spectrum for \ref Dynamic.
+ */
+template <size_t Channels> struct ColorType { using type = Vector<float, Channels>; };
+template <> struct ColorType<Dynamic> { using type = Spectrum; };
+template <size_t Channels> using Color = typename ColorType<Channels>::type;
+
+template <size_t Channels> class BasicRegistry;
+template <size_t Channels> class BasicBoundBRDF;
+class Tensor;
+
+/// Options controlling how a BRDF is loaded
+struct LoadOptions {
+    /**
+     * When nonzero, the color table is not loaded up front. Instead, the
+     * slices associated with individual incident directions (phi_i, theta_i)
+     * are constructed on demand from the memory-mapped file and kept in a
+     * cache that occupies at most this many bytes. This bounds the memory
+     * requirements of very high-resolution materials, whose grazing-angle
+     * slices (for instance) are rarely needed.
+     */
+    size_t slice_cache_size = 0;
+
+    /**
+     * Number of coarser levels of detail that are constructed in addition
+     * to the full-resolution tables. Each level halves the resolution of the
+     * 2D grids of all tables (down to 2x2) and has its own consistent CDFs.
+     * Renderers can select coarse levels on deep bounces via the \c lod
+     * parameter of \c eval(), \c sample() and \c pdf() to improve cache hit
+     * rates. Cannot be combined with \c slice_cache_size.
+     */
+    uint32_t lod_levels = 0;
+
+    /**
+     * When nonzero, the spectra are projected onto a per-material basis
+     * consisting of this many principal components (between 2 and 16) at
+     * load time. Only the basis coefficients of each texel are stored, and
+     * evaluation reconstructs the spectrum from them. Measured reflectance
+     * spectra are smooth, hence a few coefficients typically suffice, which
+     * shrinks the largest table several times and replaces per-wavelength
+     * lookups by a few coefficient lookups. Cannot be combined with
+     * \c slice_cache_size.
+     */
+    uint32_t spectral_basis_size = 0;
+
+    /**
+     * Place a copy of the tables on each NUMA node of the machine (Linux
+     * only). Queries then automatically read the copy that is local to the
+     * socket of the calling thread, which avoids remote memory accesses on
+     * multi-socket machines at the cost of one copy per node. The slice
+     * cache of \c slice_cache_size is shared and not replicated. Has no
+     * effect on machines with a single node.
+     */
+    bool numa_replicate = false;
+
+    /**
+     * Memory resource that provides the storage of the tables (e.g. a
+     * \c HugePageResource). The material keeps the resource alive. When
+     * unset, the tables are stored in aligned heap memory.
+     */
+    std::shared_ptr<MemoryResource> memory_resource;
+};
+
+/// Options controlling the parallel bulk queries of a BRDF (e.g. \c eval_bulk())
+struct BulkOptions {
+    /// Number of worker threads (0: one per hardware thread)
+    uint32_t threads = 0;
+
+    /**
+     * Number of queries per unit of work that is scheduled or stolen by the
+     * workers. It is rounded up to a multiple of 16, hence workers never
+     * write to the same cache line of output buffers aligned to \c Alignment
+     * (unless \c sort is set).
+     */
+    size_t chunk_size = 4096;
+
+    /**
+     * Process the queries ordered by the cell of the tabulated incident
+     * directions (phi_i, theta_i) that contains \c wi, so that consecutive
+     * queries interpolate the same slices of the tables. The results are
+     * still written to the position of each query. Sorting costs one pass
+     * over the incident directions and a counting sort of \c count indices,
+     * which pays off when the queries arrive in an incoherent order (e.g.
+     * path order) and the tables exceed the cache.
+     */
+    bool sort = false;
+
+    /**
+     * If not \c nullptr and \c sort is set, receives the time in seconds that
+     * was spent computing the order of the queries, which can be weighed
+     * against the speedup of the sorted queries.
+     */
+    double *sort_seconds = nullptr;
+
+    /**
+     * Let \c sample_bulk() advance the table lookups of several queries
+     * round-robin, prefetching the next load of each query before switching
+     * to the next one. This overlaps the latency of the dependent loads of
+     * independent queries, which pays off when the tables exceed the cache.
+     * The results are identical.
+     */
+    bool interleave = false;
+};
+
+/**
+ * \brief Analytic approximation of a measured material
+ *
+ * Consists of a Lambertian lobe and an anisotropic GGX lobe with Smith
+ * shadowing-masking. The roughness is fitted to the tabulated NDF, and the
+ * weights of both lobes are fitted to the full model by least squares. The
+ * proxy is cheap to evaluate and intended for interactive previews and deep
+ * bounces, where the fidelity of the full model is not needed.
+ */
+template <size_t Channels> struct BasicProxy {
+    /// Albedo of the diffuse lobe
+    Color<Channels> diffuse;
+
+    /// Scale factor of the specular lobe
+    Color<Channels> specular;
+
+    /// Roughness of the specular lobe along the tangent and bitangent
+    float alpha_u, alpha_v;
+
+    /// Evaluate f_r * cos
+    Color<Channels> eval(const Vector3f &wi, const Vector3f &wo) const;
+};
+
+/// Resolution and memory usage of a level of detail
+struct LevelInfo {
+    /// Resolution of the VNDF table
+    uint32_t vndf_resolution[2];
+
+    /// Resolution of the luminance and color tables
+    uint32_t color_resolution[2];
+
+    /// Number of bytes occupied by the tables of this level
+    size_t memory_usage;
+};
+
+/**
+ * \brief Read-only view of a material pack
+ *
+ * A pack bundles many tensor files along with an index that maps entry names
+ * to their location. The whole pack is memory-mapped once, and materials are
+ * constructed directly from the mapped contents without intermediate copies.
+ * Packs are created using the \c python/pack.py script.
+ */
+class Pack {
     struct Data;
-    std::unique_ptr<Data> m_data;
+    std::shared_ptr<Data> m_data;
+    template <size_t Channels> friend class BasicBRDF;
 public:
-    // ctor / dtor
-    BRDF(const std::string &path_to_file);
-    ~BRDF();
+    Pack(const std::string &filename);
+    ~Pack();
+
+    /// Return the names of all entries in the pack
+    std::vector<std::string> entries() const;
+
+    /// Does the pack contain an entry of the specified name?
+    bool has_entry(const std::string &name) const;
+};
+
+/**
+ * \brief Measured BRDF with a given number of color channels
+ *
+ * For <tt>Channels = Dynamic</tt>, the channels are those of the file (e.g. the
+ * tabulated wavelengths of a spectral material), and values are returned as a
+ * \c Spectrum. Constant channel counts return fixed-size vectors that live on
+ * the stack, and the loops over the channels are unrolled by the compiler.
+ * Their channel count must match the file, except for <tt>Channels = 1</tt>:
+ * such BRDFs are converted to luminance (CIE Y) at load time and only
+ * interpolate a single color table. The aliases \c powitacq::BRDF and
+ * \c powitacq_rgb::BRDF refer to the spectral and RGB variants.
+ */
+template <size_t Channels> class BasicBRDF {
+    struct Data;
+    std::shared_ptr<Data> m_data;
+    friend class BasicRegistry<Channels>;
+    friend class BasicBoundBRDF<Channels>;
+public:
+    /// Type used to represent the values of the BRDF
+    using Value = Color<Channels>;
 
-    /// Get the wavelengths sample points
+    // ctor / dtor
+    BasicBRDF(const std::string &path_to_file,
+              const LoadOptions &options = LoadOptions());
+    BasicBRDF(const Pack &pack, const std::string &name,
+              const LoadOptions &options = LoadOptions());
+    BasicBRDF(const BasicBRDF &other);
+    BasicBRDF(BasicBRDF &&other);
+    BasicBRDF &operator=(const BasicBRDF &other);
+    BasicBRDF &operator=(BasicBRDF &&other);
+    ~BasicBRDF();
+
+    /**
+     * Load a BRDF on a background thread and return a future that becomes
+     * ready once all tables have been constructed. The tensor fields are
+     * read concurrently and the independent warps are built in parallel.
+     * Loading errors are rethrown by \c std::future::get().
+     */
+    static std::future<BasicBRDF> load_async(const std::string &path_to_file,
+                                             const LoadOptions &options = LoadOptions());
+
+    /**
+     * Write the fully constructed tables of the material into a
+     * position-independent image at \c path (e.g. a file in /dev/shm, which
+     * names a shared memory segment on Linux). The image replaces any
+     * existing file atomically. Materials loaded with a slice cache cannot
+     * be published, and NUMA replicas are not included.
+     */
+    void publish(const std::string &path) const;
+
+    /**
+     * Map an image written by \c publish() read-only and construct a material
+     * that references its tables in place, without parsing or building any
+     * CDFs. Processes that attach the same image share a single copy of the
+     * tables in memory. The channel count must match that of the publisher.
+     */
+    static BasicBRDF attach(const std::string &path);
+
+    /// Return the number of channels
+    size_t channels() const;
+
+    /// Get the wavelengths sample points (empty unless loaded from a spectral file with all channels)
     const Spectrum &wavelengths() const;
 
+    /*
+     * The \c lod parameter of the following three functions selects a
+     * level of detail (0: full resolution, see \ref LoadOptions::lod_levels).
+     * Values beyond the coarsest level refer to the coarsest level.
+     */
+
     /// Evaluate f_r * cos
-    Spectrum eval(const Vector3f &wi, const Vector3f &wo) const;
+    Value eval(const Vector3f &wi, const Vector3f &wo, uint32_t lod = 0) const;
+
+    /// Importance sample f_r * cos(theta) using two uniform variates.
+    /// Returns f_r * cos / pdf, as well as the outgoing direction and PDF.
+    Value sample(const Vector2f &u,
+                 const Vector3f &wi,
+                 Vector3f *wo = nullptr,
+                 float *pdf = nullptr,
+                 uint32_t lod = 0) const;
+
+    /// Evaluate the PDF of a sample
+    float pdf(const Vector3f &wi, const Vector3f &wo, uint32_t lod = 0) const;
+
+    /**
+     * Evaluate the luminance (CIE Y) of f_r * cos. This only accesses the
+     * luminance table that is used for importance sampling and never the
+     * color table, which makes it considerably cheaper than \c eval() when
+     * color is not needed (e.g. for importance estimates or shadow catchers).
+     */
+    float eval_luminance(const Vector3f &wi, const Vector3f &wo, uint32_t lod = 0) const;
+
+    /// Monochrome variant of \c sample() that returns the luminance of f_r * cos / pdf
+    float sample_luminance(const Vector2f &u,
+                           const Vector3f &wi,
+                           Vector3f *wo = nullptr,
+                           float *pdf = nullptr,
+                           uint32_t lod = 0) const;
+
+    /**
+     * Fix the incident direction \c wi, e.g. to evaluate many outgoing
+     * directions for direct illumination or final gathering. The returned
+     * object precomputes all quantities that only depend on \c wi, including
+     * the slices of the tables at (phi_i, theta_i). Binding costs about as
+     * much as a few dozen queries, after which each query of the returned
+     * object is considerably cheaper than the corresponding query of the BRDF.
+     */
+    BasicBoundBRDF<Channels> bind(const Vector3f &wi, uint32_t lod = 0) const;
+
+    /**
+     * Issue software prefetches for the lines of the VNDF, luminance and
+     * color tables that queries with the incident direction \c wi read
+     * first (the marginal CDF and the first row of the conditional CDF of
+     * the interpolated slices), so that they hit in the cache. Wavefront
+     * renderers can call this for the next batch of directions while
+     * shading the current one. Note that the prefetched amount grows with
+     * the number of channels (see \ref LoadOptions::spectral_basis_size),
+     * and that the color table of out-of-core materials is not prefetched.
+     */
+    void prefetch(const Vector3f &wi, uint32_t lod = 0) const;
+
+    /// Prefetch the tables for each of \c count incident directions
+    void prefetch(size_t count, const Vector3f *wi, uint32_t lod = 0) const;
+
+    /**
+     * The following functions perform \c count independent queries on a pool
+     * of worker threads that balance their load by work stealing, which is
+     * intended for baking, fitting and training data generation. Query \c i
+     * reads element \c i of the input arrays and writes its result in place:
+     * element \c i of \c pdf and \c wo, and channels <tt>[i * channels(),
+     * (i + 1) * channels())</tt> of \c out. The \c wo and \c pdf outputs of
+     * \c sample_bulk() are optional.
+     */
+
+    /// Evaluate \c eval() for many pairs of directions
+    void eval_bulk(size_t count, const Vector3f *wi, const Vector3f *wo, float *out,
+                   const BulkOptions &options = BulkOptions(), uint32_t lod = 0) const;
+
+    /// Evaluate \c sample() for many pairs of uniform variates and incident directions
+    void sample_bulk(size_t count, const Vector2f *u, const Vector3f *wi, Vector3f *wo,
+                     float *pdf, float *out, const BulkOptions &options = BulkOptions(),
+                     uint32_t lod = 0) const;
+
+    /// Evaluate \c pdf() for many pairs of directions
+    void pdf_bulk(size_t count, const Vector3f *wi, const Vector3f *wo, float *pdf,
+                  const BulkOptions &options = BulkOptions(), uint32_t lod = 0) const;
+
+    /**
+     * Return the directional albedo, i.e. the integral of f_r * cos over all
+     * outgoing directions, for the incident direction \c wi. Useful e.g. for
+     * Russian roulette, albedo AOVs, or light selection. The albedo is
+     * integrated at each tabulated incident direction in parallel upon the
+     * first call and interpolated afterwards.
+     */
+    Value albedo(const Vector3f &wi) const;
+
+    /// Return an analytic approximation of the material (fitted upon the first call)
+    const BasicProxy<Channels> &proxy() const;
+
+    /// Return the resolution and memory usage of each level of detail
+    std::vector<LevelInfo> levels() const;
+
+    /// Return the number of bytes occupied by the BRDF's tables
+    size_t memory_usage() const;
+
+    /// Is the material isotropic?
+    bool isotropic() const;
+
+private:
+    BasicBRDF(const std::shared_ptr<Data> &data);
+    void init(const Tensor &tf, const LoadOptions &options);
+    Value zero() const;
+
+    /* Implementations of eval(), sample() and pdf() for general and isotropic
+       tables. The result is written to \c fr, which holds the channels of the
+       color (a \c Value or a view of a bulk output buffer) or the luminance. */
+    template <typename Tables, typename Out>
+    void eval_impl(const Tables &tables, const Vector3f &wi, const Vector3f &wo,
+                   Out &fr) const;
+    template <typename Tables, typename Out>
+    void sample_impl(const Tables &tables, const Vector2f &u, const Vector3f &wi,
+                     Vector3f *wo, float *pdf, Out &fr) const;
+    template <typename Tables, typename Out>
+    void sample_finish(const Tables &tables, const Vector3f &wi, float phi_i,
+                       float theta_i, const Vector2f &sample, float lum_pdf,
+                       const Vector2f &u_wm, float ndf_pdf, Vector3f *wo,
+                       float *pdf, Out &fr) const;
+    template <typename Tables>
+    void sample_block(const Tables &tables, size_t count, const size_t *index,
+                      const Vector2f *u, const Vector3f *wi, Vector3f *wo,
+                      float *pdf, float *out) const;
+    template <typename Tables>
+    float pdf_impl(const Tables &tables, const Vector3f &wi, const Vector3f &wo) const;
+    template <typename Tables>
+    BasicBoundBRDF<Channels> bind_impl(const Tables &tables, const Vector3f &wi) const;
+    template <typename Tables>
+    void prefetch_impl(const Tables &tables, const Vector3f &wi) const;
+
+    /// Interpolate the color table at position \c sample of the slice (phi_i, theta_i)
+    template <typename Tables, typename Out>
+    void color(const Tables &tables, const Vector2f &sample,
+               float phi_i, float theta_i, Out &fr) const;
+
+    /// Interpolate the luminance at position \c sample of the slice (phi_i, theta_i)
+    template <typename Tables>
+    void color(const Tables &tables, const Vector2f &sample,
+               float phi_i, float theta_i, float &fr) const;
+};
+
+/**
+ * \brief Measured BRDF with a fixed incident direction (see \ref BasicBRDF::bind())
+ *
+ * The queries are equivalent to those of the BRDF with the bound incident
+ * direction and level of detail.
+ */
+template <size_t Channels> class BasicBoundBRDF {
+public:
+    using Value = Color<Channels>;
+
+    /// Evaluate f_r * cos for the outgoing direction \c wo
+    Value eval(const Vector3f &wo) const;
 
     /// Importance sample f_r * cos(theta) using two uniform variates.
     /// Returns f_r * cos / pdf, as well as the outgoing direction and PDF.
-    Spectrum sample(const Vector2f &u,
-                    const Vector3f &wi,
-                    Vector3f *wo = nullptr,
-                    float *pdf = nullptr) const;
+    Value sample(const Vector2f &u, Vector3f *wo = nullptr, float *pdf = nullptr) const;
 
-    /// evaluate the PDF of a sample
-    float pdf(const Vector3f &wi, const Vector3f &wo) const;
+    /// Evaluate the PDF of sampling the outgoing direction \c wo
+    float pdf(const Vector3f &wo) const;
+
+    /// Return the bound incident direction
+    const Vector3f &wi() const;
+
+private:
+    friend class BasicBRDF<Channels>;
+    struct Data;
+    std::shared_ptr<const Data> m_data;
+
+    BasicBoundBRDF(const std::shared_ptr<const Data> &data);
+};
+
+/**
+ * \brief BRDF whose material can be replaced while other threads query it
+ *
+ * Intended for look development, where material files are re-exported while
+ * an interactive renderer is running. \c store() and \c reload() publish a
+ * new material by atomically swapping a pointer, and concurrent queries
+ * observe either the old or the new material without taking any locks.
+ *
+ * Replaced materials are released using epoch-based reclamation: each query
+ * announces the current epoch in a slot owned by the calling thread (a store
+ * and a fence, after the thread's first query registered the slot), and a
+ * material that was replaced at epoch \c e is released as soon as no thread
+ * is inside a query that started at an epoch <= \c e. The handle itself must
+ * outlive all queries.
+ */
+template <size_t Channels> class BasicReloadableBRDF {
+public:
+    using Value = Color<Channels>;
+
+    BasicReloadableBRDF(const BasicBRDF<Channels> &brdf);
+    ~BasicReloadableBRDF();
+
+    /// Publish \c brdf as the material used by subsequent queries
+    void store(const BasicBRDF<Channels> &brdf);
+
+    /**
+     * Load a material from \c path_to_file (bypassing the \c Registry) and
+     * publish it. On failure, the exception is rethrown and the current
+     * material remains in place.
+     */
+    void reload(const std::string &path_to_file,
+                const LoadOptions &options = LoadOptions());
+
+    /// Return a (reference-counted) handle to the current material
+    BasicBRDF<Channels> load() const;
+
+    /// Evaluate f_r * cos using the current material (see \ref BasicBRDF::eval())
+    Value eval(const Vector3f &wi, const Vector3f &wo, uint32_t lod = 0) const;
+
+    /// Importance sample the current material (see \ref BasicBRDF::sample())
+    Value sample(const Vector2f &u, const Vector3f &wi, Vector3f *wo = nullptr,
+                 float *pdf = nullptr, uint32_t lod = 0) const;
+
+    /// Evaluate the PDF of the current material (see \ref BasicBRDF::pdf())
+    float pdf(const Vector3f &wi, const Vector3f &wo, uint32_t lod = 0) const;
+
+    /**
+     * Release the replaced materials that are no longer used by any thread
+     * (this also happens upon \c store()), and return the number of
+     * replaced materials that remain.
+     */
+    size_t collect();
+
+private:
+    struct Data;
+    std::unique_ptr<Data> m_data;
+};
+
+/**
+ * \brief Process-wide registry of loaded materials
+ *
+ * BRDFs obtained via \c load() share their tables with all other users of the
+ * same file (copies of a \c BRDF instance are cheap, reference-counted
+ * handles). Materials that are no longer referenced remain resident so that
+ * they can be reused later on, until the total size of all resident materials
+ * exceeds a configurable byte budget. At this point, the least recently used
+ * unreferenced materials are evicted. Each channel count has its own registry.
+ */
+template <size_t Channels> class BasicRegistry {
+public:
+    /// Return the process-wide registry instance
+    static BasicRegistry &instance();
+
+    ~BasicRegistry();
+
+    /// Load a BRDF, or return a shared handle to an already resident one
+    BasicBRDF<Channels> load(const std::string &path_to_file,
+                             const LoadOptions &options = LoadOptions());
+
+    /// Set the byte budget of resident materials (default: unlimited)
+    void set_budget(size_t bytes);
+
+    /// Return the byte budget of resident materials
+    size_t budget() const;
+
+    /// Evict unreferenced materials (least recently used first) until the budget is met
+    void trim();
+
+    /// Return the total number of bytes occupied by resident materials
+    size_t resident_bytes() const;
+
+    /// Return the number of bytes occupied by each resident material
+    std::vector<std::pair<std::string, size_t>> usage() const;
 
 private:
-    Spectrum zero() const;
+    BasicRegistry();
+    BasicRegistry(const BasicRegistry &) = delete;
+    BasicRegistry &operator=(const BasicRegistry &) = delete;
+
+    struct State;
+    std::unique_ptr<State> m_state;
 };
 
+/**
+ * \brief Dense lookup table approximating a BRDF for fast evaluation
+ *
+ * The table samples \c BRDF::eval() on a regular grid over the half/difference
+ * angle parameterization (theta_h, theta_d, phi_d) of Rusinkiewicz, which is
+ * extended by the half vector azimuth phi_h for anisotropic materials.
+ * Evaluation then amounts to a single trilinear (quadrilinear) fetch.
+ *
+ * This trades accuracy for speed, and the resulting approximation error is
+ * reported by \c error(). A renderer could, e.g., switch from the full model to
+ * the table beyond a certain path depth.
+ */
+template <size_t Channels> class BasicBakedBRDF {
+public:
+    /// Approximation error of f_r * cos with respect to \c BRDF::eval()
+    struct Error {
+        Color<Channels> max_error;
+        Color<Channels> rms_error;
+    };
+
+    /**
+     * Bake \c brdf into a table with the specified resolution. Passing
+     * <tt>res_phi_h = 0</tt> selects 1 for isotropic and 16 for anisotropic
+     * materials. The error is estimated using \c error_samples random pairs
+     * of directions.
+     */
+    BasicBakedBRDF(const BasicBRDF<Channels> &brdf, uint32_t res_theta_h = 64,
+                   uint32_t res_theta_d = 32, uint32_t res_phi_d = 32,
+                   uint32_t res_phi_h = 0, uint32_t error_samples = 65536);
+
+    /// Evaluate f_r * cos
+    Color<Channels> eval(const Vector3f &wi, const Vector3f &wo) const;
+
+    /// Return the approximation error with respect to the full model
+    const Error &error() const;
+
+    /// Return the number of bytes occupied by the table
+    size_t memory_usage() const;
+
+private:
+    struct Data;
+    std::shared_ptr<Data> m_data;
+};
+
+/* Spectral variant */
+using BRDF = BasicBRDF<Dynamic>;
+using Registry = BasicRegistry<Dynamic>;
+using Proxy = BasicProxy<Dynamic>;
+using BakedBRDF = BasicBakedBRDF<Dynamic>;
+using BoundBRDF = BasicBoundBRDF<Dynamic>;
+using ReloadableBRDF = BasicReloadableBRDF<Dynamic>;
+
+/* The implementation is compiled once for the following channel counts */
+extern template struct BasicProxy<1>;
+extern template struct BasicProxy<3>;
+extern template struct BasicProxy<Dynamic>;
+extern template class BasicBRDF<1>;
+extern template class BasicBRDF<3>;
+extern template class BasicBRDF<Dynamic>;
+extern template class BasicBoundBRDF<1>;
+extern template class BasicBoundBRDF<3>;
+extern template class BasicBoundBRDF<Dynamic>;
+extern template class BasicReloadableBRDF<1>;
+extern template class BasicReloadableBRDF<3>;
+extern template class BasicReloadableBRDF<Dynamic>;
+extern template class BasicRegistry<1>;
+extern template class BasicRegistry<3>;
+extern template class BasicRegistry<Dynamic>;
+extern template class BasicBakedBRDF<1>;
+extern template class BasicBakedBRDF<3>;
+extern template class BasicBakedBRDF<Dynamic>;
+
 POWITACQ_NAMESPACE_END
 
+/**
+ * BRDFs with a constant number of channels (e.g. the RGB version of the eval()
+ * and sample() methods) return sRGB color values by default. Negative (out of
+ * gamut) values are simply clipped to zero. To use a different RGB gamut,
+ * define
+ *
+ *    #define POWITACQ_CLIP_RGB 0
+ *
+ * before including this file, in which case the clipping operation is
+ * disabled. You should then be able to transform the RGB values into your
+ * color space of choice.
+ */
+#if !defined(POWITACQ_CLIP_RGB)
+#  define POWITACQ_CLIP_RGB 1
+#endif
+
+/**
+ * Each query converts its directions into spherical coordinates, which
+ * involves several inverse trigonometric functions (and sine/cosine pairs in
+ * sample()). Defining
+ *
+ *    #define POWITACQ_FAST_MATH 1
+ *
+ * before including this file replaces these functions by branch-free
+ * polynomial approximations that can be vectorized by the compiler. Their
+ * maximum absolute error is 2e-6 radians (elevation and azimuth) and 1e-7
+ * (sine and cosine of arguments in [-4*pi, 4*pi]), which is far below the
+ * resolution of the tabulated data.
+ */
+#if !defined(POWITACQ_FAST_MATH)
+#  define POWITACQ_FAST_MATH 0
+#endif
+
 #ifdef POWITACQ_IMPLEMENTATION
 #  include "powitacq.inl"
 #endif
@@ -1,10 +1,40 @@
 #include <cmath>
 #include <cstdint>        // uint32_t, etc.
 #include <cstring>        // memcpy
+#include <cstdio>         // sscanf
 #include <stdexcept>      // std::runtime_error
 #include <limits>         // std::numeric_limits
 #include <sstream>        // std::ostringstream
 #include <unordered_map>
+#include <future>         // std::async
+#include <mutex>          // std::mutex
+#include <list>           // std::list
+#include <cstdlib>        // posix_memalign
+#include <thread>         // std::thread::hardware_concurrency
+#include <atomic>         // std::atomic
+#include <algorithm>      // std::sort
+#include <random>         // std::mt19937
+#include <fstream>        // std::ifstream
+#include <new>            // placement new
+#include <condition_variable> // std::condition_variable
+#include <functional>     // std::function
+#include <chrono>         // std::chrono::steady_clock
+
+#if !defined(_WIN32)
+#  include <fcntl.h>      // open
+#  include <unistd.h>     // close
+#  include <sys/mman.h>   // mmap
+#  include <sys/stat.h>   // fstat
+#endif
+
+#if defined(__linux__)
+#  include <sched.h>      // sched_getcpu
+#  include <pthread.h>    // pthread_setaffinity_np
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#  include <xmmintrin.h>  // _mm_prefetch
+#endif
 
 #define POWITACQ_SAMPLE_LUMINANCE 1
 
@@ -44,6 +74,12 @@ static constexpr float OneMinusEpsilon = 0.999999940395355225f;
         for (size_t i = 0; i < Dim; ++i)                                       \
             v1[i] op v2[i];                                                    \
         return v1;                                                             \
+    }                                                                          \
+    template <typename T, size_t Dim>                                          \
+    Vector<T, Dim> &operator op(Vector<T, Dim> &v1, T s) {                     \
+        for (size_t i = 0; i < Dim; ++i)                                       \
+            v1[i] op s;                                                        \
+        return v1;                                                             \
     }
 
 POWITACQ_ARITHMETIC_OPERATOR(+)
@@ -106,6 +142,470 @@ template <typename T, size_t Dim> Vector<T, Dim> normalize(const Vector<T, Dim>
     return v / std::sqrt(dot(v, v));
 }
 
+/**
+ * Channels of a query result stored in a caller-provided buffer, which lets
+ * the bulk queries write their results in place without constructing a
+ * (heap-allocated, for \c Dynamic channels) \c Color per query
+ */
+struct ChannelSpan {
+    float *data;
+    size_t size;
+
+    float &operator[](size_t i) const { return data[i]; }
+
+    ChannelSpan &operator*=(float s) {
+        for (size_t i = 0; i < size; ++i)
+            data[i] *= s;
+        return *this;
+    }
+
+    ChannelSpan &operator/=(float s) {
+        for (size_t i = 0; i < size; ++i)
+            data[i] /= s;
+        return *this;
+    }
+};
+
+/// Set the \c channels channels of a query result to zero
+template <typename Out> void set_zero(Out &out, size_t channels) {
+    for (size_t i = 0; i < channels; ++i)
+        out[i] = 0.f;
+}
+
+inline void set_zero(float &out, size_t) { out = 0.f; }
+
+// *****************************************************************************
+// Aligned memory allocation
+// *****************************************************************************
+
+/// Allocate a block of memory whose address is a multiple of \c Alignment
+static void *aligned_malloc(size_t size) {
+    void *ptr = nullptr;
+#if defined(_WIN32)
+    ptr = _aligned_malloc(size, Alignment);
+#else
+    if (posix_memalign(&ptr, Alignment, size) != 0)
+        ptr = nullptr;
+#endif
+    if (!ptr && size != 0)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+/// Release a block of memory allocated by \c aligned_malloc()
+static void aligned_free(void *ptr) {
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+/// Issue software prefetches for all cache lines overlapping <tt>[ptr, ptr + size)</tt>
+inline void prefetch_range(const void *ptr, size_t size) {
+    if (size == 0)
+        return;
+    uintptr_t begin = (uintptr_t) ptr & ~(uintptr_t) (Alignment - 1),
+              end   = (uintptr_t) ptr + size;
+    for (uintptr_t addr = begin; addr < end; addr += Alignment) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch((const void *) addr, 0, 3);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        _mm_prefetch((const char *) addr, _MM_HINT_T0);
+#endif
+    }
+}
+
+/**
+ * STL-compatible allocator returning memory aligned to \c Alignment bytes,
+ * which is taken from \c resource if specified. Containers adopt the
+ * allocator of the container they are assigned from.
+ *
+ * An allocator created by \c borrow() instead hands out existing (possibly
+ * read-only) memory that already holds the elements: it is neither
+ * initialized nor released, hence the container must not grow. Copies of
+ * such a container allocate their own storage.
+ */
+template <typename T> struct AlignedAllocator {
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    AlignedAllocator(MemoryResource *resource = nullptr)
+        : resource(resource), borrowed(nullptr) { }
+    template <typename T2> AlignedAllocator(const AlignedAllocator<T2> &other)
+        : resource(other.resource), borrowed(other.borrowed) { }
+
+    /// Return an allocator whose storage is the memory at \c ptr
+    static AlignedAllocator borrow(const void *ptr) {
+        AlignedAllocator result;
+        result.borrowed = ptr;
+        return result;
+    }
+
+    T *allocate(size_t n) {
+        if (borrowed)
+            return (T *) borrowed;
+        return (T *) (resource ? resource->allocate(n * sizeof(T))
+                               : aligned_malloc(n * sizeof(T)));
+    }
+
+    void deallocate(T *ptr, size_t n) {
+        if (borrowed)
+            return;
+        if (resource)
+            resource->deallocate(ptr, n * sizeof(T));
+        else
+            aligned_free(ptr);
+    }
+
+    /// Value-initialize new elements unless the storage is borrowed
+    template <typename U> void construct(U *ptr) {
+        if (!borrowed)
+            ::new ((void *) ptr) U();
+    }
+
+    template <typename U, typename... Args> void construct(U *ptr, Args &&... args) {
+        ::new ((void *) ptr) U(std::forward<Args>(args)...);
+    }
+
+    AlignedAllocator select_on_container_copy_construction() const {
+        return AlignedAllocator(resource);
+    }
+
+    template <typename T2> bool operator==(const AlignedAllocator<T2> &other) const {
+        return resource == other.resource && borrowed == other.borrowed;
+    }
+    template <typename T2> bool operator!=(const AlignedAllocator<T2> &other) const {
+        return !operator==(other);
+    }
+
+    MemoryResource *resource;
+    const void *borrowed;
+};
+
+/// Storage for tabulated data, its start is aligned to \c Alignment bytes
+using FloatStorage = std::vector<float, AlignedAllocator<float>>;
+
+struct HugePageResource::Data {
+    struct Block {
+        /// Size of the mapping (a multiple of the huge page size)
+        size_t size;
+        /// Was the block mapped using explicit huge pages?
+        bool explicit_pages;
+    };
+
+    Mode mode;
+    size_t threshold;
+    size_t page_size = 2 * 1024 * 1024;
+
+    mutable std::mutex mutex;
+    std::unordered_map<void *, Block> blocks;
+    size_t allocated = 0;
+};
+
+HugePageResource::HugePageResource(Mode mode, size_t threshold) : m_data(new Data()) {
+    m_data->mode = mode;
+    m_data->threshold = threshold;
+
+#if defined(__linux__)
+    /* Query the default huge page size */
+    std::ifstream meminfo("/proc/meminfo");
+    std::string key;
+    size_t value;
+    while (meminfo >> key) {
+        if (key == "Hugepagesize:" && (meminfo >> value)) {
+            m_data->page_size = value * 1024;
+            break;
+        }
+        meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+#endif
+}
+
+HugePageResource::~HugePageResource() { }
+
+void *HugePageResource::allocate(size_t size) {
+#if defined(__linux__)
+    if (size >= m_data->threshold) {
+        size_t page = m_data->page_size,
+               mapped = (size + page - 1) / page * page;
+        void *ptr = MAP_FAILED;
+        bool explicit_pages = false;
+
+        if (m_data->mode == Explicit) {
+            ptr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            explicit_pages = ptr != MAP_FAILED;
+        }
+
+        if (ptr == MAP_FAILED) {
+            /* Fall back to regular pages, but align the mapping to a huge page
+               boundary so that the kernel can promote it */
+            uint8_t *base = (uint8_t *) mmap(nullptr, mapped + page, PROT_READ | PROT_WRITE,
+                                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (base == (uint8_t *) MAP_FAILED)
+                throw std::bad_alloc();
+
+            uint8_t *aligned = (uint8_t *) (((uintptr_t) base + page - 1) &
+                                            ~(uintptr_t) (page - 1));
+            if (aligned != base)
+                munmap(base, aligned - base);
+            if (aligned + mapped != base + mapped + page)
+                munmap(aligned + mapped, base + page - aligned);
+        #if defined(MADV_HUGEPAGE)
+            madvise(aligned, mapped, MADV_HUGEPAGE);
+        #endif
+            ptr = aligned;
+        }
+
+        std::lock_guard<std::mutex> guard(m_data->mutex);
+        m_data->blocks[ptr] = Data::Block{ mapped, explicit_pages };
+        m_data->allocated += mapped;
+        return ptr;
+    }
+#endif
+
+    void *ptr = aligned_malloc(size);
+    std::lock_guard<std::mutex> guard(m_data->mutex);
+    m_data->allocated += size;
+    return ptr;
+}
+
+void HugePageResource::deallocate(void *ptr, size_t size) {
+    if (!ptr)
+        return;
+
+    std::unique_lock<std::mutex> guard(m_data->mutex);
+    auto it = m_data->blocks.find(ptr);
+    if (it == m_data->blocks.end()) {
+        m_data->allocated -= size;
+        guard.unlock();
+        aligned_free(ptr);
+        return;
+    }
+
+    size_t mapped = it->second.size;
+    m_data->blocks.erase(it);
+    m_data->allocated -= mapped;
+    guard.unlock();
+#if defined(__linux__)
+    munmap(ptr, mapped);
+#endif
+}
+
+size_t HugePageResource::allocated_bytes() const {
+    std::lock_guard<std::mutex> guard(m_data->mutex);
+    return m_data->allocated;
+}
+
+size_t HugePageResource::huge_page_bytes() const {
+    std::lock_guard<std::mutex> guard(m_data->mutex);
+    size_t result = 0;
+    bool transparent = false;
+    for (const auto &block : m_data->blocks) {
+        if (block.second.explicit_pages)
+            result += block.second.size;
+        else
+            transparent = true;
+    }
+
+#if defined(__linux__)
+    if (!transparent)
+        return result;
+
+    /* Attribute the transparent huge pages of each mapping of the process
+       to the blocks that it contains */
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    size_t overlap = 0;
+    while (std::getline(smaps, line)) {
+        unsigned long long start, end, kb;
+        if (sscanf(line.c_str(), "%llx-%llx", &start, &end) == 2 &&
+            line.find(':') > line.find(' ')) {
+            overlap = 0;
+            for (const auto &block : m_data->blocks) {
+                if (block.second.explicit_pages)
+                    continue;
+                unsigned long long b0 = (uintptr_t) block.first,
+                                   b1 = b0 + block.second.size;
+                if (b0 < end && b1 > start)
+                    overlap += std::min(b1, end) - std::max(b0, start);
+            }
+        } else if (overlap > 0 &&
+                   sscanf(line.c_str(), "AnonHugePages: %llu kB", &kb) == 1) {
+            result += std::min((size_t) kb * 1024, overlap);
+        }
+    }
+#endif
+
+    return result;
+}
+
+/// Number of bytes that an array of \c count floats occupies in an \c Arena
+inline size_t arena_size(size_t count) {
+    return (count * sizeof(float) + Alignment - 1) / Alignment * Alignment;
+}
+
+/**
+ * Memory resource that carves all allocations out of a single block whose
+ * size is computed in advance (e.g. from the layout of all tables of a
+ * material), so that they are adjacent in memory and require a single
+ * allocation. Allocations that do not fit indicate an incorrect layout and
+ * throw an exception. Memory within the block is only released with the arena.
+ *
+ * The tables reference the block through absolute pointers, hence the block
+ * itself cannot be copied or mapped at another address. The relocatable form
+ * of a material is the image written by \c BasicBRDF::publish(), which
+ * stores the same arrays at offsets and is mapped by \c BasicBRDF::attach().
+ */
+class Arena : public MemoryResource {
+public:
+    Arena(size_t capacity, MemoryResource *upstream)
+        : m_upstream(upstream), m_capacity(capacity), m_used(0) {
+        m_data = (uint8_t *) (upstream ? upstream->allocate(capacity)
+                                       : aligned_malloc(capacity));
+    }
+
+    ~Arena() {
+        release(m_data, m_capacity);
+    }
+
+    void *allocate(size_t size) override {
+        size = (size + Alignment - 1) / Alignment * Alignment;
+        size_t offset = m_used.fetch_add(size);
+        if (offset + size > m_capacity)
+            throw std::runtime_error(
+                "Arena: the precomputed layout (" + std::to_string(m_capacity) +
+                " bytes) is too small for an allocation of " + std::to_string(size) +
+                " bytes at offset " + std::to_string(offset));
+        return m_data + offset;
+    }
+
+    /// Memory within the block is only released with the arena
+    void deallocate(void *, size_t) override { }
+
+    /// Write to all pages of the block, which places them on the NUMA node of the caller
+    void touch() { memset(m_data, 0, m_capacity); }
+
+    /// Return the start of the block
+    const uint8_t *data() const { return m_data; }
+
+    /// Return the number of bytes of the block that are in use
+    size_t size() const { return std::min(m_used.load(), m_capacity); }
+
+    /// Return the size of the block
+    size_t capacity() const { return m_capacity; }
+
+private:
+    void release(void *ptr, size_t size) {
+        if (m_upstream)
+            m_upstream->deallocate(ptr, size);
+        else
+            aligned_free(ptr);
+    }
+
+private:
+    MemoryResource *m_upstream;
+    uint8_t *m_data;
+    size_t m_capacity;
+    std::atomic<size_t> m_used;
+};
+
+/// Copy the range <tt>[begin, end)</tt> into storage allocated from \c resource
+inline FloatStorage copy_storage(const float *begin, const float *end,
+                                 MemoryResource *resource) {
+    return FloatStorage(begin, end, AlignedAllocator<float>(resource));
+}
+
+// *****************************************************************************
+// Position-independent images of constructed materials
+// *****************************************************************************
+
+/// Identifies images written by \c BasicBRDF::publish()
+static const char ImageMagic[16] = "powitacq_image";
+static constexpr uint32_t ImageVersion = 1;
+
+/**
+ * Serializes data into a position-independent image. Scalars are stored
+ * consecutively, and arrays of floats start at offsets that are multiples of
+ * \c Alignment, so that \c ImageReader can reference them in place. Without
+ * a buffer, the writer only determines the size of the image.
+ */
+class ImageWriter {
+public:
+    ImageWriter(uint8_t *data = nullptr) : m_data(data), m_size(0) { }
+
+    void write(const void *ptr, size_t size) {
+        if (m_data && size > 0)
+            memcpy(m_data + m_size, ptr, size);
+        m_size += size;
+    }
+
+    template <typename T> void write(const T &value) {
+        write(&value, sizeof(T));
+    }
+
+    void write_array(const float *ptr, size_t count) {
+        write((uint64_t) count);
+        m_size = (m_size + Alignment - 1) / Alignment * Alignment;
+        write(ptr, count * sizeof(float));
+    }
+
+    void write(const FloatStorage &storage) {
+        write_array(storage.data(), storage.size());
+    }
+
+    /// Return the number of bytes written so far
+    size_t size() const { return m_size; }
+
+private:
+    uint8_t *m_data;
+    size_t m_size;
+};
+
+/// Reads an image produced by \c ImageWriter, whose base address should be aligned to \c Alignment
+class ImageReader {
+public:
+    ImageReader(const uint8_t *data, size_t size, const std::string &filename)
+        : m_data(data), m_size(size), m_pos(0), m_filename(filename) { }
+
+    void read(void *ptr, size_t size) {
+        if (size > m_size - m_pos)
+            throw std::runtime_error("Invalid material image (truncated?): " + m_filename);
+        memcpy(ptr, m_data + m_pos, size);
+        m_pos += size;
+    }
+
+    template <typename T> T read() {
+        T value;
+        read(&value, sizeof(T));
+        return value;
+    }
+
+    /// Return storage that references the next array of the image in place
+    FloatStorage read_array() {
+        uint64_t count = read<uint64_t>();
+        m_pos = std::min((m_pos + Alignment - 1) / Alignment * Alignment, m_size);
+        if (count > (m_size - m_pos) / sizeof(float))
+            throw std::runtime_error("Invalid material image (truncated?): " + m_filename);
+        if (count == 0)
+            return FloatStorage();
+
+        const uint8_t *ptr = m_data + m_pos;
+        m_pos += count * sizeof(float);
+        return FloatStorage((size_t) count, AlignedAllocator<float>::borrow(ptr));
+    }
+
+    const std::string &filename() const { return m_filename; }
+
+private:
+    const uint8_t *m_data;
+    size_t m_size, m_pos;
+    std::string m_filename;
+};
+
 // *****************************************************************************
 // Bisection search for intervals
 // *****************************************************************************
@@ -153,6 +653,9 @@ size_t find_interval(size_t size_, const Predicate &pred) {
 // Marginal-conditional warp
 // *****************************************************************************
 
+/// Number of queries that \c Marginal2D::sample_interleaved() advances round-robin
+static constexpr size_t InterleavedQueries = 8;
+
 /**
  * \brief Implements a marginal sample warping scheme for 2D distributions
  * with linear interpolation and an optional dependence on additional parameters
@@ -179,8 +682,6 @@ size_t find_interval(size_t size_, const Predicate &pred) {
  */
 template <size_t Dimension = 0> class Marginal2D {
 private:
-    using FloatStorage = std::vector<float>;
-
 #if !defined(_MSC_VER)
     static constexpr size_t ArraySize = Dimension;
 #else
@@ -210,9 +711,11 @@ public:
     Marginal2D(const Vector2u &size, const float *data,
                std::array<uint32_t, Dimension> param_res = { },
                std::array<const float *, Dimension> param_values = { },
-               bool normalize = true, bool build_cdf = true)
+               bool normalize = true, bool build_cdf = true,
+               MemoryResource *resource = nullptr)
         : m_size(size), m_patch_size(Vector2f(1.f) / Vector2f(m_size - 1u)),
           m_inv_patch_size(m_size - 1u) {
+        AlignedAllocator<float> alloc(resource);
 
         if (build_cdf && !normalize)
             throw std::runtime_error("Marginal2D: build_cdf implies normalize=true");
@@ -224,7 +727,7 @@ public:
                 throw std::runtime_error("Marginal2D(): parameter resolution must be >= 1!");
 
             m_param_size[i] = param_res[i];
-            m_param_values[i] = FloatStorage(param_res[i]);
+            m_param_values[i] = FloatStorage(param_res[i], alloc);
             memcpy(m_param_values[i].data(), param_values[i],
                    sizeof(float) * param_res[i]);
             m_param_strides[i] = param_res[i] > 1 ? slices : 0;
@@ -233,11 +736,11 @@ public:
 
         uint32_t n_values = hprod(size);
 
-        m_data = FloatStorage(slices * n_values);
+        m_data = FloatStorage(slices * n_values, alloc);
 
         if (build_cdf) {
-            m_marginal_cdf = FloatStorage(slices * m_size.y());
-            m_conditional_cdf = FloatStorage(slices * n_values);
+            m_marginal_cdf = FloatStorage(slices * m_size.y(), alloc);
+            m_conditional_cdf = FloatStorage(slices * n_values, alloc);
 
             float *marginal_cdf = m_marginal_cdf.data(),
                   *conditional_cdf = m_conditional_cdf.data(),
@@ -427,6 +930,28 @@ public:
         };
     }
 
+    /**
+     * \brief Draw \c count independent samples like \c sample(), where
+     * query \c i warps <tt>samples[i]</tt> in place, writes its density to
+     * <tt>pdf[i]</tt> and uses the parameters <tt>param + i * param_stride</tt>
+     *
+     * Each query of \c sample() is a chain of dependent loads (marginal
+     * search, conditional search, density fetch), which leaves the memory
+     * system idle while a single query waits. This function advances groups
+     * of \c InterleavedQueries queries round-robin, and each query prefetches
+     * its next load before control moves on to the next query, so that the
+     * loads of different queries overlap. The results are identical to those
+     * of \c sample().
+     */
+    void sample_interleaved(size_t count, Vector2f *samples, float *pdf,
+                            const float *param = nullptr,
+                            size_t param_stride = 0) const {
+        for (size_t i = 0; i < count; i += InterleavedQueries)
+            sample_group(std::min(count - i, InterleavedQueries), samples + i,
+                         pdf + i, param ? param + i * param_stride : nullptr,
+                         param_stride);
+    }
+
     /// Inverse of the mapping implemented in \c sample()
     std::pair<Vector2f, float> invert(Vector2f sample,
                                       const float *param = nullptr) const {
@@ -575,57 +1100,861 @@ public:
                hprod(m_inv_patch_size);
     }
 
-private:
-        template <size_t Dim, std::enable_if_t<Dim != 0, int> = 0>
-         float lookup(const float *data, uint32_t i0,
-                      uint32_t size, const float *param_weight) const {
-            uint32_t i1 = i0 + m_param_strides[Dim - 1] * size;
+    /**
+     * \brief Evaluate the density at position \c pos, where the slice
+     * associated with each discretized parameter configuration is multiplied
+     * by the corresponding entry of \c slice_scale before interpolating. This
+     * can be used to undo the per-slice normalization of the density.
+     */
+    float eval(Vector2f pos, const float *param, const float *slice_scale) const {
+        /* Look up parameter-related indices and weights (if Dimension != 0) */
+        float param_weight[2 * ArraySize];
+        uint32_t slice_offset = 0u;
 
-            float w0 = param_weight[2 * Dim - 2],
-                  w1 = param_weight[2 * Dim - 1],
-                  v0 = lookup<Dim - 1>(data, i0, size, param_weight),
-                  v1 = lookup<Dim - 1>(data, i1, size, param_weight);
+        for (size_t dim = 0; dim < Dimension; ++dim) {
+            if (m_param_size[dim] == 1) {
+                param_weight[2 * dim] = 1.f;
+                param_weight[2 * dim + 1] = 0.f;
+                continue;
+            }
 
-            return std::fma(v0, w0, v1 * w1);
-        }
+            uint32_t param_index = find_interval(
+                m_param_size[dim],
+                [&](uint32_t idx) {
+                    return m_param_values[dim][idx] <= param[dim];
+                });
 
-        template <size_t Dim, std::enable_if_t<Dim == 0, int> = 0>
-        float lookup(const float *data, uint32_t index, uint32_t,
-                     const float *) const {
-            return data[index];
+            float p0 = m_param_values[dim][param_index],
+                  p1 = m_param_values[dim][param_index + 1];
+
+            param_weight[2 * dim + 1] =
+                clamp((param[dim] - p0) / (p1 - p0), 0.f, 1.f);
+            param_weight[2 * dim] = 1.f - param_weight[2 * dim + 1];
+            slice_offset += m_param_strides[dim] * param_index;
         }
 
-    private:
-        /// Resolution of the discretized density function
-        Vector2u m_size;
+        /* Compute linear interpolation weights */
+        pos *= m_inv_patch_size;
+        Vector2u offset = min(Vector2u(pos), m_size - 2u);
 
-        /// Size of a bilinear patch in the unit square
-        Vector2f m_patch_size, m_inv_patch_size;
+        Vector2f w1 = pos - Vector2f(Vector2i(offset)),
+                 w0 = Vector2f(1.f) - w1;
 
-        /// Resolution of each parameter (optional)
-        uint32_t m_param_size[ArraySize];
+        uint32_t index = offset.x() + offset.y() * m_size.x();
 
-        /// Stride per parameter in units of sizeof(float)
-        uint32_t m_param_strides[ArraySize];
+        uint32_t size = hprod(m_size);
+        if (Dimension != 0)
+            index += slice_offset * size;
 
-        /// Discretization of each parameter domain
-        FloatStorage m_param_values[ArraySize];
+        float v00 = lookup<Dimension>(m_data.data(), index, size,
+                                      param_weight, slice_scale, slice_offset),
+              v10 = lookup<Dimension>(m_data.data() + 1, index, size,
+                                      param_weight, slice_scale, slice_offset),
+              v01 = lookup<Dimension>(m_data.data() + m_size.x(), index, size,
+                                      param_weight, slice_scale, slice_offset),
+              v11 = lookup<Dimension>(m_data.data() + m_size.x() + 1, index, size,
+                                      param_weight, slice_scale, slice_offset);
 
-        /// Density values
-        FloatStorage m_data;
+        return std::fma(w0.y(), std::fma(w0.x(), v00, w1.x() * v10),
+                        w1.y() * std::fma(w0.x(), v01, w1.x() * v11)) *
+               hprod(m_inv_patch_size);
+    }
 
-        /// Marginal and conditional PDFs
-        FloatStorage m_marginal_cdf;
-        FloatStorage m_conditional_cdf;
-};
+    /**
+     * \brief Return the distribution for the parameter values \c param as a
+     * warp without parameters
+     *
+     * Its tables are the interpolated slices of this warp, hence queries of
+     * the result are equivalent to queries of this warp with \c param, but
+     * skip the parameter lookups and access a single slice.
+     */
+    Marginal2D<0> slice(const float *param) const {
+        /* Look up parameter-related indices and weights (if Dimension != 0) */
+        float param_weight[2 * ArraySize];
+        uint32_t slice_offset = 0u;
 
-using Warp2D0 = Marginal2D<0>;
-using Warp2D2 = Marginal2D<2>;
-using Warp2D3 = Marginal2D<3>;
+        for (size_t dim = 0; dim < Dimension; ++dim) {
+            if (m_param_size[dim] == 1) {
+                param_weight[2 * dim] = 1.f;
+                param_weight[2 * dim + 1] = 0.f;
+                continue;
+            }
 
-// *****************************************************************************
-// Tensor file I/O
-// *****************************************************************************
+            uint32_t param_index = find_interval(
+                m_param_size[dim],
+                [&](uint32_t idx) {
+                    return m_param_values[dim][idx] <= param[dim];
+                });
+
+            float p0 = m_param_values[dim][param_index],
+                  p1 = m_param_values[dim][param_index + 1];
+
+            param_weight[2 * dim + 1] =
+                clamp((param[dim] - p0) / (p1 - p0), 0.f, 1.f);
+            param_weight[2 * dim] = 1.f - param_weight[2 * dim + 1];
+            slice_offset += m_param_strides[dim] * param_index;
+        }
+
+        Marginal2D<0> result;
+        result.m_size = m_size;
+        result.m_patch_size = m_patch_size;
+        result.m_inv_patch_size = m_inv_patch_size;
+
+        auto blend = [&](const FloatStorage &in, uint32_t size, FloatStorage &out) {
+            if (in.empty())
+                return;
+            out.resize(size);
+            for (uint32_t i = 0; i < size; ++i)
+                out[i] = lookup<Dimension>(in.data(), slice_offset * size + i,
+                                           size, param_weight);
+        };
+
+        uint32_t n_values = hprod(m_size);
+        blend(m_data, n_values, result.m_data);
+        blend(m_marginal_cdf, m_size.y(), result.m_marginal_cdf);
+        blend(m_conditional_cdf, n_values, result.m_conditional_cdf);
+        return result;
+    }
+
+    /**
+     * \brief Prefetch the cache lines that queries with the parameter values
+     * \c param read first
+     *
+     * These are the marginal CDF and the first row of the conditional CDF of
+     * the (up to <tt>2^Dimension</tt>) slices that are interpolated for
+     * \c param. The other rows depend on the position within the slice and
+     * are not prefetched. With <tt>count > 1</tt>, this covers the queries
+     * for \c count consecutive tabulated values of the last parameter
+     * starting at <tt>param[Dimension - 1]</tt> (e.g. the channels of a color
+     * table), where each slice shared by neighboring values is prefetched
+     * once.
+     */
+    void prefetch(const float *param, uint32_t count = 1) const {
+        /* Look up the index of the first slice (if Dimension != 0) */
+        uint32_t slice_offset = 0u, remaining = 2u;
+
+        for (size_t dim = 0; dim < Dimension; ++dim) {
+            if (m_param_size[dim] == 1)
+                continue;
+
+            uint32_t param_index = find_interval(
+                m_param_size[dim],
+                [&](uint32_t idx) {
+                    return m_param_values[dim][idx] <= param[dim];
+                });
+
+            slice_offset += m_param_strides[dim] * param_index;
+            if (dim + 1 == Dimension)
+                remaining = m_param_size[dim] - param_index;
+        }
+
+        prefetch_slices<Dimension>(slice_offset, std::min(count + 1, remaining));
+    }
+
+    /// Copy \c other, allocating the tables from \c resource
+    Marginal2D(const Marginal2D &other, MemoryResource *resource)
+        : m_size(other.m_size), m_patch_size(other.m_patch_size),
+          m_inv_patch_size(other.m_inv_patch_size) {
+        AlignedAllocator<float> alloc(resource);
+        for (size_t i = 0; i < Dimension; ++i) {
+            m_param_size[i] = other.m_param_size[i];
+            m_param_strides[i] = other.m_param_strides[i];
+            m_param_values[i] = FloatStorage(other.m_param_values[i].begin(),
+                                             other.m_param_values[i].end(), alloc);
+        }
+        m_data = FloatStorage(other.m_data.begin(), other.m_data.end(), alloc);
+        m_marginal_cdf = FloatStorage(other.m_marginal_cdf.begin(),
+                                      other.m_marginal_cdf.end(), alloc);
+        m_conditional_cdf = FloatStorage(other.m_conditional_cdf.begin(),
+                                         other.m_conditional_cdf.end(), alloc);
+    }
+
+    /// Append the warp to a position-independent image
+    void write(ImageWriter &writer) const {
+        writer.write(m_size);
+        writer.write(m_patch_size);
+        writer.write(m_inv_patch_size);
+        for (size_t i = 0; i < Dimension; ++i) {
+            writer.write(m_param_size[i]);
+            writer.write(m_param_strides[i]);
+            writer.write(m_param_values[i]);
+        }
+        writer.write(m_data);
+        writer.write(m_marginal_cdf);
+        writer.write(m_conditional_cdf);
+    }
+
+    /// Reference the tables of a warp within an image written by \c write()
+    Marginal2D(ImageReader &reader) {
+        m_size = reader.read<Vector2u>();
+        m_patch_size = reader.read<Vector2f>();
+        m_inv_patch_size = reader.read<Vector2f>();
+
+        size_t slices = 1, n_values = hprod(m_size);
+        bool valid = true;
+        for (size_t i = 0; i < Dimension; ++i) {
+            m_param_size[i] = reader.read<uint32_t>();
+            m_param_strides[i] = reader.read<uint32_t>();
+            m_param_values[i] = reader.read_array();
+            valid &= m_param_values[i].size() == m_param_size[i];
+            slices *= m_param_size[i];
+        }
+        m_data = reader.read_array();
+        m_marginal_cdf = reader.read_array();
+        m_conditional_cdf = reader.read_array();
+
+        valid &= m_data.size() == slices * n_values &&
+                 (m_marginal_cdf.empty() || m_marginal_cdf.size() == slices * m_size.y()) &&
+                 m_conditional_cdf.size() == (m_marginal_cdf.empty() ? 0 : m_data.size());
+        if (!valid)
+            throw std::runtime_error("Invalid material image (inconsistent table sizes): " +
+                                     reader.filename());
+    }
+
+    /**
+     * Return the number of bytes that a warp with the given resolution and
+     * parameters allocates from an \c Arena
+     */
+    static size_t storage_size(const Vector2u &size, const uint32_t *param_res,
+                               bool build_cdf) {
+        size_t slices = 1, result = 0, n_values = hprod(size);
+        for (size_t i = 0; i < Dimension; ++i) {
+            result += arena_size(param_res[i]);
+            slices *= param_res[i];
+        }
+        result += arena_size(slices * n_values);
+        if (build_cdf)
+            result += arena_size(slices * size.y()) + arena_size(slices * n_values);
+        return result;
+    }
+
+    /// Return the resolution of the discretized density function
+    const Vector2u &size() const { return m_size; }
+
+    /// Return the number of bytes occupied by the warp's tables
+    size_t memory_usage() const {
+        size_t result = m_data.size() + m_marginal_cdf.size() +
+                        m_conditional_cdf.size();
+        for (size_t i = 0; i < Dimension; ++i)
+            result += m_param_values[i].size();
+        return result * sizeof(float);
+    }
+
+private:
+        template <size_t> friend class Marginal2D;
+
+        template <size_t Dim, std::enable_if_t<Dim != 0, int> = 0>
+         float lookup(const float *data, uint32_t i0,
+                      uint32_t size, const float *param_weight) const {
+            uint32_t i1 = i0 + m_param_strides[Dim - 1] * size;
+
+            float w0 = param_weight[2 * Dim - 2],
+                  w1 = param_weight[2 * Dim - 1],
+                  v0 = lookup<Dim - 1>(data, i0, size, param_weight),
+                  v1 = lookup<Dim - 1>(data, i1, size, param_weight);
+
+            return std::fma(v0, w0, v1 * w1);
+        }
+
+        template <size_t Dim, std::enable_if_t<Dim == 0, int> = 0>
+        float lookup(const float *data, uint32_t index, uint32_t,
+                     const float *) const {
+            return data[index];
+        }
+
+        template <size_t Dim, std::enable_if_t<Dim != 0, int> = 0>
+         float lookup(const float *data, uint32_t i0, uint32_t size,
+                      const float *param_weight, const float *slice_scale,
+                      uint32_t s0) const {
+            uint32_t i1 = i0 + m_param_strides[Dim - 1] * size,
+                     s1 = s0 + m_param_strides[Dim - 1];
+
+            float w0 = param_weight[2 * Dim - 2],
+                  w1 = param_weight[2 * Dim - 1],
+                  v0 = lookup<Dim - 1>(data, i0, size, param_weight, slice_scale, s0),
+                  v1 = lookup<Dim - 1>(data, i1, size, param_weight, slice_scale, s1);
+
+            return std::fma(v0, w0, v1 * w1);
+        }
+
+        template <size_t Dim, std::enable_if_t<Dim == 0, int> = 0>
+        float lookup(const float *data, uint32_t index, uint32_t,
+                     const float *, const float *slice_scale,
+                     uint32_t slice) const {
+            return data[index] * slice_scale[slice];
+        }
+
+        /// Prefetch the entries read by \c lookup()
+        template <size_t Dim, std::enable_if_t<Dim != 0, int> = 0>
+        void prefetch_lookup(const float *data, uint32_t i0, uint32_t size) const {
+            prefetch_lookup<Dim - 1>(data, i0, size);
+            prefetch_lookup<Dim - 1>(data, i0 + m_param_strides[Dim - 1] * size, size);
+        }
+
+        template <size_t Dim, std::enable_if_t<Dim == 0, int> = 0>
+        void prefetch_lookup(const float *data, uint32_t index, uint32_t) const {
+            prefetch_range(data + index, sizeof(float));
+        }
+
+        /// State machine of \c sample_interleaved() for up to \c InterleavedQueries queries
+        void sample_group(size_t count, Vector2f *samples, float *pdf,
+                          const float *param, size_t param_stride) const {
+            using ssize_t = std::make_signed_t<size_t>;
+
+            enum Stage : uint8_t {
+                MarginalSearch, ConditionalBounds, ConditionalSearch, Density, Done
+            };
+
+            struct Query {
+                Vector2f sample;
+                float param_weight[2 * ArraySize];
+                uint32_t slice_offset, offset, row, col;
+                ssize_t first, size;
+                Stage stage;
+            } queries[InterleavedQueries];
+
+            uint32_t slice_size = hprod(m_size);
+
+            auto fetch_marginal = [&](const Query &q, uint32_t idx) -> float {
+                return lookup<Dimension>(m_marginal_cdf.data(), q.offset + idx,
+                                         m_size.y(), q.param_weight);
+            };
+
+            auto fetch_conditional = [&](const Query &q, uint32_t idx) -> float {
+                float v0 = lookup<Dimension>(m_conditional_cdf.data(), q.offset + idx,
+                                             slice_size, q.param_weight),
+                      v1 = lookup<Dimension>(m_conditional_cdf.data() + m_size.x(),
+                                             q.offset + idx, slice_size, q.param_weight);
+
+                return (1.f - q.sample.y()) * v0 + q.sample.y() * v1;
+            };
+
+            /* Look up parameter-related indices and weights, and start the marginal search */
+            for (size_t i = 0; i < count; ++i) {
+                Query &q = queries[i];
+                const float *p = param ? param + i * param_stride : nullptr;
+
+                /* Avoid degeneracies at the extrema */
+                q.sample = clamp(samples[i], 1.f - OneMinusEpsilon, OneMinusEpsilon);
+
+                uint32_t &slice_offset = q.slice_offset;
+                slice_offset = 0u;
+                for (size_t dim = 0; dim < Dimension; ++dim) {
+                    if (m_param_size[dim] == 1) {
+                        q.param_weight[2 * dim] = 1.f;
+                        q.param_weight[2 * dim + 1] = 0.f;
+                        continue;
+                    }
+
+                    uint32_t param_index = find_interval(
+                        m_param_size[dim],
+                        [&](uint32_t idx) {
+                            return m_param_values[dim].data()[idx] <= p[dim];
+                        }
+                    );
+
+                    float p0 = m_param_values[dim][param_index],
+                          p1 = m_param_values[dim][param_index + 1];
+
+                    q.param_weight[2 * dim + 1] =
+                        clamp((p[dim] - p0) / (p1 - p0), 0.f, 1.f);
+                    q.param_weight[2 * dim] = 1.f - q.param_weight[2 * dim + 1];
+                    slice_offset += m_param_strides[dim] * param_index;
+                }
+
+                q.offset = Dimension != 0 ? slice_offset * m_size.y() : 0;
+                q.first = 1;
+                q.size = (ssize_t) m_size.y() - 2;
+                q.stage = MarginalSearch;
+                if (q.size > 0)
+                    prefetch_lookup<Dimension>(m_marginal_cdf.data(),
+                                               q.offset + q.first + (q.size >> 1),
+                                               m_size.y());
+            }
+
+            /* Advance the queries round-robin by one dependent load at a time */
+            size_t active = count;
+            while (active > 0) {
+                for (size_t i = 0; i < count; ++i) {
+                    Query &q = queries[i];
+
+                    switch (q.stage) {
+                        case MarginalSearch: {
+                            /* One step of find_interval() over the marginal CDF */
+                            if (q.size > 0) {
+                                size_t half   = (size_t) q.size >> 1,
+                                       middle = q.first + half;
+                                bool pred_result =
+                                    fetch_marginal(q, (uint32_t) middle) < q.sample.y();
+                                q.first = pred_result ? middle + 1 : q.first;
+                                q.size = pred_result ? q.size - (half + 1) : half;
+                            }
+
+                            if (q.size > 0) {
+                                prefetch_lookup<Dimension>(m_marginal_cdf.data(),
+                                                           q.offset + q.first + (q.size >> 1),
+                                                           m_size.y());
+                                break;
+                            }
+
+                            q.row = (uint32_t) clamp(q.first - 1, (ssize_t) 0,
+                                                     (ssize_t) m_size.y() - 2);
+                            q.sample.y() -= fetch_marginal(q, q.row);
+
+                            q.offset = q.row * m_size.x();
+                            if (Dimension != 0)
+                                q.offset += q.slice_offset * slice_size;
+
+                            prefetch_lookup<Dimension>(m_conditional_cdf.data(),
+                                                       q.offset + m_size.x() - 1, slice_size);
+                            prefetch_lookup<Dimension>(m_conditional_cdf.data(),
+                                                       q.offset + (m_size.x() * 2 - 1), slice_size);
+                            q.stage = ConditionalBounds;
+                            break;
+                        }
+
+                        case ConditionalBounds: {
+                            float r0 = lookup<Dimension>(m_conditional_cdf.data(),
+                                                         q.offset + m_size.x() - 1, slice_size,
+                                                         q.param_weight),
+                                  r1 = lookup<Dimension>(m_conditional_cdf.data(),
+                                                         q.offset + (m_size.x() * 2 - 1), slice_size,
+                                                         q.param_weight);
+
+                            bool is_const = std::abs(r0 - r1) < 1e-4f * (r0 + r1);
+                            q.sample.y() = is_const ? (2.f * q.sample.y()) :
+                                (r0 - std::sqrt(r0 * r0 - 2.f * q.sample.y() * (r0 - r1)));
+                            q.sample.y() /= is_const ? (r0 + r1) : (r0 - r1);
+
+                            q.sample.x() *= (1.f - q.sample.y()) * r0 + q.sample.y() * r1;
+
+                            q.first = 1;
+                            q.size = (ssize_t) m_size.x() - 2;
+                            q.stage = ConditionalSearch;
+                            if (q.size > 0) {
+                                uint32_t middle = (uint32_t) (q.first + (q.size >> 1));
+                                prefetch_lookup<Dimension>(m_conditional_cdf.data(),
+                                                           q.offset + middle, slice_size);
+                                prefetch_lookup<Dimension>(m_conditional_cdf.data() + m_size.x(),
+                                                           q.offset + middle, slice_size);
+                            }
+                            break;
+                        }
+
+                        case ConditionalSearch: {
+                            /* One step of find_interval() over the conditional CDF */
+                            if (q.size > 0) {
+                                size_t half   = (size_t) q.size >> 1,
+                                       middle = q.first + half;
+                                bool pred_result =
+                                    fetch_conditional(q, (uint32_t) middle) < q.sample.x();
+                                q.first = pred_result ? middle + 1 : q.first;
+                                q.size = pred_result ? q.size - (half + 1) : half;
+                            }
+
+                            if (q.size > 0) {
+                                uint32_t middle = (uint32_t) (q.first + (q.size >> 1));
+                                prefetch_lookup<Dimension>(m_conditional_cdf.data(),
+                                                           q.offset + middle, slice_size);
+                                prefetch_lookup<Dimension>(m_conditional_cdf.data() + m_size.x(),
+                                                           q.offset + middle, slice_size);
+                                break;
+                            }
+
+                            q.col = (uint32_t) clamp(q.first - 1, (ssize_t) 0,
+                                                     (ssize_t) m_size.x() - 2);
+                            q.sample.x() -= fetch_conditional(q, q.col);
+                            q.offset += q.col;
+
+                            prefetch_lookup<Dimension>(m_data.data(), q.offset, slice_size);
+                            prefetch_lookup<Dimension>(m_data.data() + 1, q.offset, slice_size);
+                            prefetch_lookup<Dimension>(m_data.data() + m_size.x(), q.offset,
+                                                       slice_size);
+                            prefetch_lookup<Dimension>(m_data.data() + m_size.x() + 1, q.offset,
+                                                       slice_size);
+                            q.stage = Density;
+                            break;
+                        }
+
+                        case Density: {
+                            Vector2f sample = q.sample;
+                            float v00 = lookup<Dimension>(m_data.data(), q.offset, slice_size,
+                                                          q.param_weight),
+                                  v10 = lookup<Dimension>(m_data.data() + 1, q.offset, slice_size,
+                                                          q.param_weight),
+                                  v01 = lookup<Dimension>(m_data.data() + m_size.x(), q.offset,
+                                                          slice_size, q.param_weight),
+                                  v11 = lookup<Dimension>(m_data.data() + m_size.x() + 1, q.offset,
+                                                          slice_size, q.param_weight),
+                                  c0  = std::fma((1.f - sample.y()), v00, sample.y() * v01),
+                                  c1  = std::fma((1.f - sample.y()), v10, sample.y() * v11);
+
+                            bool is_const = std::abs(c0 - c1) < 1e-4f * (c0 + c1);
+                            sample.x() = is_const ? (2.f * sample.x()) :
+                                (c0 - std::sqrt(c0 * c0 - 2.f * sample.x() * (c0 - c1)));
+                            sample.x() /= is_const ? (c0 + c1) : (c0 - c1);
+
+                            samples[i] = (Vector2f(q.col, q.row) + sample) * m_patch_size;
+                            pdf[i] = ((1.f - sample.x()) * c0 + sample.x() * c1) *
+                                     hprod(m_inv_patch_size);
+
+                            q.stage = Done;
+                            active--;
+                            break;
+                        }
+
+                        case Done:
+                            break;
+                    }
+                }
+            }
+        }
+
+        /**
+         * Prefetch the first lines of the slices visited by \c lookup()
+         * starting at slice \c s0, where \c count consecutive values of
+         * parameter <tt>Dim - 1</tt> are visited (2 for the other parameters)
+         */
+        template <size_t Dim, std::enable_if_t<Dim != 0, int> = 0>
+        void prefetch_slices(uint32_t s0, uint32_t count) const {
+            uint32_t stride = m_param_strides[Dim - 1];
+            if (stride == 0)
+                count = 1;
+            for (uint32_t i = 0; i < count; ++i)
+                prefetch_slices<Dim - 1>(s0 + i * stride, 2);
+        }
+
+        template <size_t Dim, std::enable_if_t<Dim == 0, int> = 0>
+        void prefetch_slices(uint32_t slice, uint32_t) const {
+            prefetch_range(m_marginal_cdf.data() + (size_t) slice * m_size.y(),
+                           m_size.y() * sizeof(float));
+            prefetch_range(m_conditional_cdf.data() + (size_t) slice * hprod(m_size),
+                           m_size.x() * sizeof(float));
+        }
+
+    private:
+        /// Resolution of the discretized density function
+        Vector2u m_size;
+
+        /// Size of a bilinear patch in the unit square
+        Vector2f m_patch_size, m_inv_patch_size;
+
+        /// Resolution of each parameter (optional)
+        uint32_t m_param_size[ArraySize];
+
+        /// Stride per parameter in units of sizeof(float)
+        uint32_t m_param_strides[ArraySize];
+
+        /// Discretization of each parameter domain
+        FloatStorage m_param_values[ArraySize];
+
+        /// Density values
+        FloatStorage m_data;
+
+        /// Marginal and conditional PDFs
+        FloatStorage m_marginal_cdf;
+        FloatStorage m_conditional_cdf;
+};
+
+using Warp2D0 = Marginal2D<0>;
+using Warp2D2 = Marginal2D<2>;
+using Warp2D3 = Marginal2D<3>;
+
+// *****************************************************************************
+// Out-of-core marginal-conditional warp
+// *****************************************************************************
+
+/**
+ * \brief Hint that the pages backing a region of a read-only file mapping
+ * will not be needed in the near future. They are transparently re-read
+ * from the file when accessed again.
+ */
+static void release_pages(const void *ptr, size_t size) {
+#if !defined(_WIN32)
+    uintptr_t page_size = (uintptr_t) sysconf(_SC_PAGESIZE),
+              start = ((uintptr_t) ptr + page_size - 1) & ~(page_size - 1),
+              end   = ((uintptr_t) ptr + size) & ~(page_size - 1);
+    if (end > start)
+        madvise((void *) start, end - start, MADV_DONTNEED);
+#else
+    (void) ptr; (void) size;
+#endif
+}
+
+/**
+ * Integrate the weighted sum of \c channels consecutive 2D tables of
+ * resolution \c size (e.g. the luminance of the color channels of a slice)
+ * using the trapezoidal rule, normalized to the unit square
+ */
+inline float weighted_integral(const float *values, size_t channels,
+                               const Vector2u &size, const float *weights) {
+    size_t texels = hprod(size);
+    double sum = 0.0;
+    for (uint32_t y = 0; y < size.y(); ++y) {
+        float wy = (y == 0 || y + 1 == size.y()) ? .5f : 1.f;
+        for (uint32_t x = 0; x < size.x(); ++x) {
+            float wx = (x == 0 || x + 1 == size.x()) ? .5f : 1.f,
+                  value = 0.f;
+            size_t t = x + (size_t) y * size.x();
+            for (size_t ch = 0; ch < channels; ++ch)
+                value += weights[ch] * values[ch * texels + t];
+            sum += wx * wy * value;
+        }
+    }
+    return (float) (sum / ((size.x() - 1) * (size.y() - 1)));
+}
+
+/**
+ * \brief Out-of-core variant of \c Marginal2D<Dimension> that only supports
+ * evaluation (i.e. \c normalize = \c build_cdf = \c false)
+ *
+ * The first two parameter dimensions (e.g. the incident direction (phi_i,
+ * theta_i)) enumerate a set of slices, each of which is an independent
+ * <tt>Marginal2D<Dimension - 2></tt>. Slices are constructed on demand from
+ * the (typically memory-mapped) source data and kept in a cache with a
+ * bounded size and least-recently-used replacement.
+ *
+ * Since evaluation is linear in the tabulated data, blending the slices
+ * surrounding a parameter value produces the same result as the interpolation
+ * performed by \c Marginal2D<Dimension>.
+ */
+template <size_t Dimension> class PagedMarginal2D {
+    static_assert(Dimension >= 2, "PagedMarginal2D: at least two parameters are required");
+
+public:
+    using Slice = Marginal2D<Dimension - 2>;
+    using SlicePtr = std::shared_ptr<const Slice>;
+
+    /**
+     * \brief Slices surrounding a specific value of the first two parameters
+     *
+     * Holds references to up to four slices, which therefore cannot be evicted
+     * while in use.
+     */
+    struct Slices {
+        SlicePtr slice[4];
+        float weight[4];
+        uint32_t count = 0;
+
+        /// Evaluate the density at \c pos, parameterized by the remaining parameters \c param
+        float eval(const Vector2f &pos, const float *param = nullptr) const {
+            float result = 0.f;
+            for (uint32_t i = 0; i < count; ++i)
+                result = std::fma(weight[i], slice[i]->eval(pos, param), result);
+            return result;
+        }
+    };
+
+    /**
+     * Create an out-of-core warp for the data of resolution \c size stored at
+     * \c data, which must refer to a read-only file mapping (it is kept alive
+     * by reference counting). \c cache_size specifies the
+     * maximum number of bytes occupied by resident slices. The other
+     * parameters are as in \c Marginal2D.
+     *
+     * If \c weights is specified, the \c weighted_integral() of the tables
+     * within each slice is recorded when the slice is first paged in (see
+     * \c integrals()).
+     */
+    PagedMarginal2D(const Vector2u &size, const std::shared_ptr<const uint8_t> &data,
+                    std::array<uint32_t, Dimension> param_res,
+                    std::array<const float *, Dimension> param_values,
+                    size_t cache_size, const float *weights = nullptr)
+        : m_size(size), m_source(data), m_cache_size(cache_size) {
+        m_slice_values = hprod(size);
+
+        if (weights) {
+            size_t slices = (size_t) param_res[0] * param_res[1],
+                   tables = 1;
+            for (size_t i = 2; i < Dimension; ++i)
+                tables *= param_res[i];
+            m_weights.assign(weights, weights + tables);
+            m_integrals.reset(new float[slices]());
+            m_integral_valid.assign(slices, false);
+        }
+
+        for (size_t i = 0; i < Dimension; ++i) {
+            if (param_res[i] < 1)
+                throw std::runtime_error("PagedMarginal2D(): parameter resolution must be >= 1!");
+            m_param_values[i] = FloatStorage(param_values[i],
+                                             param_values[i] + param_res[i]);
+            if (i >= 2) {
+                m_inner_res[i - 2] = param_res[i];
+                m_inner_values[i - 2] = m_param_values[i].data();
+                m_slice_values *= param_res[i];
+            }
+        }
+    }
+
+    /// Return (and pin) the slices surrounding the first two parameters \c param[0..1]
+    Slices slices(const float *param) const {
+        uint32_t index[2];
+        float weight[4];
+
+        for (size_t dim = 0; dim < 2; ++dim) {
+            const FloatStorage &values = m_param_values[dim];
+            if (values.size() == 1) {
+                index[dim] = 0;
+                weight[2 * dim] = 1.f;
+                weight[2 * dim + 1] = 0.f;
+                continue;
+            }
+
+            index[dim] = find_interval(
+                values.size(),
+                [&](uint32_t idx) {
+                    return values[idx] <= param[dim];
+                });
+
+            float p0 = values[index[dim]],
+                  p1 = values[index[dim] + 1];
+
+            weight[2 * dim + 1] =
+                clamp((param[dim] - p0) / (p1 - p0), 0.f, 1.f);
+            weight[2 * dim] = 1.f - weight[2 * dim + 1];
+        }
+
+        Slices result;
+        uint32_t stride = (uint32_t) m_param_values[1].size();
+        for (uint32_t i = 0; i < 2; ++i) {
+            for (uint32_t j = 0; j < 2; ++j) {
+                float w = weight[i] * weight[2 + j];
+                if (w == 0.f)
+                    continue;
+                result.slice[result.count] =
+                    slice((index[0] + i) * stride + index[1] + j);
+                result.weight[result.count++] = w;
+            }
+        }
+
+        return result;
+    }
+
+    /// Evaluate the density at position \c pos, parameterized by \c param
+    float eval(const Vector2f &pos, const float *param) const {
+        return slices(param).eval(pos, param + 2);
+    }
+
+    /**
+     * Page in the slices surrounding \c param[0..1] and return the integrals
+     * of all slices (indexed like the slices of a \c Marginal2D conditioned on
+     * the first two parameters). Only the entries of slices that have been
+     * paged in are valid, the others are zero.
+     */
+    const float *integrals(const float *param) const {
+        slices(param);
+        return m_integrals.get();
+    }
+
+    /// Return the number of bytes occupied by resident slices
+    size_t memory_usage() const {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        return m_cache_bytes;
+    }
+
+private:
+    /// Return the slice with the given index, constructing it if necessary
+    SlicePtr slice(uint32_t index) const {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        auto it = m_cache.find(index);
+        if (it != m_cache.end()) {
+            m_lru.splice(m_lru.begin(), m_lru, it->second.second);
+            return it->second.first;
+        }
+        guard.unlock();
+
+        /* Construct the slice without holding the lock */
+        const float *data = (const float *) m_source.get() +
+                            (size_t) index * m_slice_values;
+
+        /* Fields of tensor files need not be aligned, copy the slice if necessary */
+        FloatStorage aligned;
+        if ((uintptr_t) data % alignof(float) != 0) {
+            aligned = FloatStorage(m_slice_values);
+            memcpy(aligned.data(), data, m_slice_values * sizeof(float));
+        }
+        const float *slice_data = aligned.empty() ? data : aligned.data();
+
+        std::array<uint32_t, Dimension - 2> inner_res;
+        std::array<const float *, Dimension - 2> inner_values;
+        for (size_t i = 0; i + 2 < Dimension; ++i) {
+            inner_res[i] = m_inner_res[i];
+            inner_values[i] = m_inner_values[i];
+        }
+
+        SlicePtr result = std::make_shared<Slice>(
+            m_size, slice_data, inner_res, inner_values, false, false);
+        float integral = m_integrals
+            ? weighted_integral(slice_data, m_weights.size(), m_size, m_weights.data())
+            : 0.f;
+        release_pages(data, m_slice_values * sizeof(float));
+        size_t bytes = result->memory_usage();
+
+        guard.lock();
+
+        /* Record the integral once (readers of a resident slice's entry do not lock) */
+        if (m_integrals && !m_integral_valid[index]) {
+            m_integrals[index] = integral;
+            m_integral_valid[index] = true;
+        }
+
+        it = m_cache.find(index);
+        if (it != m_cache.end()) {
+            /* Another thread was faster */
+            m_lru.splice(m_lru.begin(), m_lru, it->second.second);
+            return it->second.first;
+        }
+
+        /* Evict least recently used slices (those in use remain valid) */
+        while (!m_lru.empty() && m_cache_bytes + bytes > m_cache_size) {
+            auto victim = m_cache.find(m_lru.back());
+            m_cache_bytes -= victim->second.first->memory_usage();
+            m_cache.erase(victim);
+            m_lru.pop_back();
+        }
+
+        m_lru.push_front(index);
+        m_cache[index] = std::make_pair(result, m_lru.begin());
+        m_cache_bytes += bytes;
+
+        return result;
+    }
+
+private:
+    /// Resolution of the discretized density function
+    Vector2u m_size;
+
+    /// Discretization of each parameter domain
+    FloatStorage m_param_values[Dimension];
+
+    /// Resolution and discretization of the parameters within a slice
+    uint32_t m_inner_res[Dimension - 2 > 0 ? Dimension - 2 : 1];
+    const float *m_inner_values[Dimension - 2 > 0 ? Dimension - 2 : 1];
+
+    /// Number of values per slice
+    size_t m_slice_values;
+
+    /// Source data
+    std::shared_ptr<const uint8_t> m_source;
+
+    /// Weights of the tables within a slice and integrals of the slices (optional)
+    std::vector<float> m_weights;
+    std::unique_ptr<float[]> m_integrals;
+    mutable std::vector<bool> m_integral_valid;
+
+    /// Resident slices and LRU list (most recently used first)
+    mutable std::mutex m_mutex;
+    mutable std::unordered_map<uint32_t, std::pair<SlicePtr, std::list<uint32_t>::iterator>> m_cache;
+    mutable std::list<uint32_t> m_lru;
+    mutable size_t m_cache_bytes = 0;
+    size_t m_cache_size;
+};
+
+using PagedWarp2D3 = PagedMarginal2D<3>;
+
+// *****************************************************************************
+// Tensor file I/O
+// *****************************************************************************
 
 class Tensor {
 public:
@@ -654,13 +1983,28 @@ public:
         /// Specifies both rank and size along each dimension
         std::vector<size_t> shape;
 
-        /// Pointer to the start of the tensor
-        std::unique_ptr<uint8_t[]> data;
+        /**
+         * Pointer to the start of the tensor. It is aligned to \c Alignment
+         * bytes unless the tensor references a memory region whose fields
+         * were written with a smaller alignment.
+         */
+        std::shared_ptr<const uint8_t> data;
     };
 
     /// Load a tensor file into memory
     Tensor(const std::string &filename);
 
+    /**
+     * \brief Interpret a memory region (e.g. a memory-mapped file) as a tensor
+     * file. The fields directly reference the region (which they keep alive),
+     * and no data is copied, even if a field is not aligned to \c Alignment.
+     */
+    Tensor(const std::shared_ptr<const uint8_t> &data, size_t size,
+           const std::string &filename);
+
+    /// Return the unmodified contents of a field within the memory region passed to the constructor
+    std::shared_ptr<const uint8_t> source(const std::string &name) const;
+
     /// Does the file contain a field of the specified name?
     bool has_field(const std::string &name) const;
 
@@ -676,10 +2020,20 @@ public:
     /// Return the name of the file from which the tensor was loaded (for compaptibility with Mitsuba's TensorFile class)
     std::string filename() const { return m_filename; }
 
+private:
+    /**
+     * Parse the header and field descriptors using the function \c read(ptr,
+     * size), which returns \c false upon failure. Returns the names and sizes
+     * (in bytes) of all fields, whose data pointers remain unset.
+     */
+    template <typename Read>
+    std::vector<std::pair<std::string, size_t>> parse(const Read &read);
+
 private:
     std::unordered_map<std::string, Field> m_fields;
     std::string m_filename;
     size_t m_size;
+    std::shared_ptr<const uint8_t> m_source;
 };
 
 static std::ostream &operator<<(std::ostream &os, Tensor::Type value) {
@@ -719,29 +2073,17 @@ static size_t type_size(Tensor::Type value) {
     }
 }
 
-Tensor::Tensor(const std::string &filename) : m_filename(filename) {
+template <typename Read>
+std::vector<std::pair<std::string, size_t>> Tensor::parse(const Read &read) {
     // Helpful macros to limit error-handling code duplication
     #define ASSERT(cond, msg)                              \
         do {                                               \
-            if (!(cond)) {                                 \
-                fclose(file);                              \
+            if (!(cond))                                   \
                 throw std::runtime_error("Tensor: " msg);  \
-            }                                              \
         } while(0)
 
     #define SAFE_READ(vars, size, count) \
-        ASSERT(fread(vars, size, count, file) == (count), "Unable to read " #vars ".")
-
-    FILE *file = fopen(filename.c_str(), "rb");
-    if (file == NULL)
-        throw std::runtime_error("Unable to open file " + filename);
-
-    ASSERT(!fseek(file, 0, SEEK_END),"Unable to seek to end of file.");
-
-    long size = ftell(file);
-    ASSERT(size != -1, "Unable to tell file cursor position.");
-    m_size = static_cast<size_t>(size);
-    rewind(file);
+        ASSERT(read(vars, (size) * (count)), "Unable to read " #vars ".")
 
     ASSERT(m_size >= 12 + 2 + 4, "Invalid tensor file: too small, truncated?");
 
@@ -754,6 +2096,7 @@ Tensor::Tensor(const std::string &filename) : m_filename(filename) {
     ASSERT(memcmp(header, "tensor_file", 12) == 0, "Invalid tensor file: invalid header.");
     ASSERT(version[0] == 1 && version[1] == 0, "Invalid tensor file: unknown file version.");
 
+    std::vector<std::pair<std::string, size_t>> fields;
     for (uint32_t i = 0; i < n_fields; ++i) {
         uint8_t dtype;
         uint16_t name_length, ndim;
@@ -775,23 +2118,93 @@ Tensor::Tensor(const std::string &filename) : m_filename(filename) {
             shape[j] = (size_t) size_value;
             total_size *= shape[j];
         }
-
-        auto data = std::unique_ptr<uint8_t[]>(new uint8_t[total_size]);
-
-        long cur_pos = ftell(file);
-        ASSERT(cur_pos != -1, "Unable to tell current cursor position.");
-        ASSERT(fseek(file, offset, SEEK_SET) != -1, "Unable to seek to tensor offset.");
-        SAFE_READ(data.get(), 1, total_size);
-        ASSERT(fseek(file, cur_pos, SEEK_SET) != -1, "Unable to seek back to current position");
+        ASSERT(offset + total_size <= m_size, "Invalid tensor file: field out of bounds.");
+        ASSERT(m_fields.find(name) == m_fields.end(), "Invalid tensor file: duplicate field.");
 
         m_fields[name] =
-            Field{ (Type) dtype, static_cast<size_t>(offset), shape, std::move(data) };
+            Field{ (Type) dtype, static_cast<size_t>(offset), shape, nullptr };
+        fields.emplace_back(name, total_size);
     }
 
-    fclose(file);
-
     #undef SAFE_READ
     #undef ASSERT
+
+    return fields;
+}
+
+Tensor::Tensor(const std::string &filename) : m_filename(filename) {
+    std::unique_ptr<FILE, int (*)(FILE *)> file(
+        fopen(filename.c_str(), "rb"), fclose);
+    if (!file)
+        throw std::runtime_error("Unable to open file " + filename);
+
+    long size = -1;
+    if (fseek(file.get(), 0, SEEK_END) == 0)
+        size = ftell(file.get());
+    if (size == -1)
+        throw std::runtime_error("Tensor: Unable to determine the file size.");
+    m_size = static_cast<size_t>(size);
+    rewind(file.get());
+
+    /* Parse the field descriptors first, the data is read afterwards */
+    auto fields = parse([&](void *ptr, size_t size) {
+        return fread(ptr, 1, size, file.get()) == size;
+    });
+    file.reset();
+
+    /* Read the field contents concurrently, each task uses its own file handle */
+    auto read_field = [&filename](Field *field, size_t total_size) {
+        FILE *file = fopen(filename.c_str(), "rb");
+        if (file == NULL)
+            throw std::runtime_error("Unable to open file " + filename);
+
+        uint8_t *data = (uint8_t *) aligned_malloc(total_size);
+        field->data = std::shared_ptr<const uint8_t>(
+            data, [](const uint8_t *p) { aligned_free((void *) p); });
+        bool success =
+            fseek(file, (long) field->offset, SEEK_SET) == 0 &&
+            fread(data, 1, total_size, file) == total_size;
+        fclose(file);
+
+        if (!success)
+            throw std::runtime_error("Tensor: Unable to read field data.");
+    };
+
+    std::vector<std::future<void>> tasks;
+    for (const auto &it : fields)
+        tasks.push_back(std::async(std::launch::async, read_field,
+                                   &m_fields[it.first], it.second));
+
+    for (auto &task : tasks)
+        task.get();
+}
+
+Tensor::Tensor(const std::shared_ptr<const uint8_t> &data, size_t size,
+               const std::string &filename)
+    : m_filename(filename), m_size(size), m_source(data) {
+    size_t pos = 0;
+    auto fields = parse([&](void *ptr, size_t size) {
+        if (pos + size > m_size)
+            return false;
+        memcpy(ptr, data.get() + pos, size);
+        pos += size;
+        return true;
+    });
+
+    /* Reference the field contents in place, even if they are not aligned to
+       'Alignment' (e.g. files written by Mitsuba or older versions of
+       write_tensor()). Consumers copy the fields that they need in-core. */
+    for (const auto &it : fields) {
+        Field &field = m_fields[it.first];
+        field.data = std::shared_ptr<const uint8_t>(data, data.get() + field.offset);
+    }
+}
+
+std::shared_ptr<const uint8_t> Tensor::source(const std::string &name) const {
+    if (!m_source)
+        throw std::runtime_error("Tensor: not backed by a memory region");
+    return std::shared_ptr<const uint8_t>(m_source,
+                                          m_source.get() + field(name).offset);
 }
 
 /// Does the file contain a field of the specified name?
@@ -843,307 +2256,2362 @@ std::string Tensor::to_string() const {
     return oss.str();
 }
 
+/**
+ * Return the contents of a \c Float32 field for in-core use. Fields of
+ * memory-mapped files are referenced in place, unless they are not even
+ * aligned to the size of a float, in which case they are copied into \c copies.
+ */
+inline const float *float_data(const Tensor::Field &field,
+                               std::vector<FloatStorage> &copies) {
+    const float *ptr = (const float *) field.data.get();
+    if ((uintptr_t) ptr % alignof(float) == 0)
+        return ptr;
+
+    size_t count = 1;
+    for (size_t size : field.shape)
+        count *= size;
+    copies.emplace_back(count);
+    memcpy(copies.back().data(), ptr, count * sizeof(float));
+    return copies.back().data();
+}
+
 // *****************************************************************************
-// BRDF implementation
+// Memory-mapped files and material packs
 // *****************************************************************************
 
-struct BRDF::Data {
-    Warp2D0 ndf;
-    Warp2D0 sigma;
-    Warp2D2 vndf;
-    Warp2D2 luminance;
-    Warp2D3 spectra;
-    Spectrum wavelengths;
-    bool isotropic;
-    bool jacobian;
-};
+/**
+ * \brief Map a file into memory (read-only)
+ *
+ * The mapping is released when the last reference to the returned pointer
+ * goes away. On platforms without \c mmap(), the file is read into memory.
+ */
+static std::shared_ptr<const uint8_t> map_file(const std::string &filename,
+                                               size_t *size_out) {
+#if !defined(_WIN32)
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw std::runtime_error("Unable to open file " + filename);
 
-// *****************************************************************************
-// BRDF convenience functions
-// *****************************************************************************
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Unable to determine the size of file " + filename);
+    }
 
-template <typename Value> Value u2theta(Value u) {
-    return sqr(u) * (Pi / 2.f);
-}
+    size_t size = (size_t) sb.st_size;
+    void *ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+        throw std::runtime_error("Unable to map file " + filename);
+
+    *size_out = size;
+    return std::shared_ptr<const uint8_t>(
+        (const uint8_t *) ptr, [size](const uint8_t *p) {
+            munmap((void *) p, size);
+        });
+#else
+    std::unique_ptr<FILE, int (*)(FILE *)> file(
+        fopen(filename.c_str(), "rb"), fclose);
+    if (!file)
+        throw std::runtime_error("Unable to open file " + filename);
 
-template <typename Value> Value u2phi(Value u) {
-    return (2.f * u - 1.f) * Pi;
-}
+    long size = -1;
+    if (fseek(file.get(), 0, SEEK_END) == 0)
+        size = ftell(file.get());
+    if (size <= 0)
+        throw std::runtime_error("Unable to determine the size of file " + filename);
+    rewind(file.get());
 
-template <typename Value> Value theta2u(Value theta) {
-    return std::sqrt(theta * (2.f / Pi));
+    uint8_t *data = new uint8_t[size];
+    std::shared_ptr<const uint8_t> result(data, std::default_delete<uint8_t[]>());
+    if (fread(data, 1, (size_t) size, file.get()) != (size_t) size)
+        throw std::runtime_error("Unable to read file " + filename);
+
+    *size_out = (size_t) size;
+    return result;
+#endif
 }
 
-template <typename Value> Value phi2u(Value phi) {
-    return (phi + Pi) / (2.f * Pi);
+struct Pack::Data {
+    std::string filename;
+
+    /// The memory-mapped pack file
+    std::shared_ptr<const uint8_t> data;
+    size_t size;
+
+    /// Maps entry names to (offset, size) pairs
+    std::unordered_map<std::string, std::pair<size_t, size_t>> index;
+
+    /// Return a tensor referencing the specified entry of the pack
+    Tensor tensor(const std::string &name) const {
+        auto it = index.find(name);
+        if (it == index.end())
+            throw std::runtime_error("Pack: unable to find entry \"" + name +
+                                     "\" in " + filename);
+        return Tensor(std::shared_ptr<const uint8_t>(data, data.get() + it->second.first),
+                      it->second.second, filename + ":" + name);
+    }
+};
+
+Pack::Pack(const std::string &filename) : m_data(new Data()) {
+    m_data->filename = filename;
+    m_data->data = map_file(filename, &m_data->size);
+
+    const uint8_t *ptr = m_data->data.get();
+    size_t pos = 0;
+    auto read = [&](void *out, size_t size) {
+        if (pos + size > m_data->size)
+            throw std::runtime_error("Pack: invalid pack file (truncated?): " + filename);
+        memcpy(out, ptr + pos, size);
+        pos += size;
+    };
+
+    uint8_t header[12], version[2];
+    uint32_t n_entries;
+    read(header, 12);
+    read(version, 2);
+    read(&n_entries, sizeof(n_entries));
+
+    if (memcmp(header, "tensor_pack", 12) != 0)
+        throw std::runtime_error("Pack: invalid header: " + filename);
+    if (version[0] != 1 || version[1] != 0)
+        throw std::runtime_error("Pack: unknown file version: " + filename);
+
+    for (uint32_t i = 0; i < n_entries; ++i) {
+        uint16_t name_length;
+        uint64_t offset, size;
+        read(&name_length, sizeof(name_length));
+        std::string name(name_length, '\0');
+        read((char *) name.data(), name_length);
+        read(&offset, sizeof(offset));
+        read(&size, sizeof(size));
+
+        if (offset + size > m_data->size)
+            throw std::runtime_error("Pack: entry \"" + name + "\" out of bounds: " + filename);
+        m_data->index[name] = std::make_pair((size_t) offset, (size_t) size);
+    }
 }
 
-Spectrum BRDF::zero() const {
-    return Spectrum(0.f, m_data->wavelengths.size());
+Pack::~Pack() { }
+
+std::vector<std::string> Pack::entries() const {
+    std::vector<std::string> result;
+    for (const auto &it : m_data->index)
+        result.push_back(it.first);
+    std::sort(result.begin(), result.end());
+    return result;
 }
 
-const Spectrum &BRDF::wavelengths() const {
-    return m_data->wavelengths;
+bool Pack::has_entry(const std::string &name) const {
+    return m_data->index.find(name) != m_data->index.end();
 }
 
 // *****************************************************************************
-// Ctor/dtor
+// Parallel execution
 // *****************************************************************************
 
-BRDF::BRDF(const std::string &path_to_file) {
-    Tensor tf = Tensor(path_to_file);
-    auto& theta_i = tf.field("theta_i");
-    auto& phi_i = tf.field("phi_i");
-    auto& ndf = tf.field("ndf");
-    auto& sigma = tf.field("sigma");
-    auto& vndf = tf.field("vndf");
-    auto& spectra = tf.field("spectra");
-    auto& luminance = tf.field("luminance");
-    auto& wavelengths = tf.field("wavelengths");
-    auto& description = tf.field("description");
-    auto& jacobian = tf.field("jacobian");
-
-    if (!(description.shape.size() == 1 &&
-          description.dtype == Tensor::UInt8 &&
+/// Invoke \c func(i) for each \c i in <tt>[0, count)</tt> using all hardware threads
+template <typename Func> void parallel_for(size_t count, const Func &func) {
+    size_t n_threads = std::min(
+        (size_t) std::max(std::thread::hardware_concurrency(), 1u), count);
+
+    std::atomic<size_t> next(0);
+    std::vector<std::future<void>> workers;
+    for (size_t i = 0; i < n_threads; ++i) {
+        workers.push_back(std::async(std::launch::async, [&]() {
+            for (size_t j = next++; j < count; j = next++)
+                func(j);
+        }));
+    }
 
-          theta_i.shape.size() == 1 &&
-          theta_i.dtype == Tensor::Float32 &&
+    for (auto &worker : workers)
+        worker.get();
+}
 
-          phi_i.shape.size() == 1 &&
-          phi_i.dtype == Tensor::Float32 &&
+/**
+ * Process-wide pool of worker threads, which are created once and then reused
+ * by all calls of \c parallel_chunks(), so that bulk queries do not pay for
+ * thread creation. Only one call uses the pool at a time; concurrent (or
+ * nested) calls perform their work on the calling thread.
+ */
+class ThreadPool {
+public:
+    /// Return the pool, which has one thread per hardware thread besides the caller
+    static ThreadPool &instance() {
+        static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+        return pool;
+    }
 
-          wavelengths.shape.size() == 1 &&
-          wavelengths.dtype == Tensor::Float32 &&
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_stop = true;
+        }
+        m_wakeup.notify_all();
+        for (auto &thread : m_threads)
+            thread.join();
+    }
 
-          ndf.shape.size() == 2 &&
-          ndf.dtype == Tensor::Float32 &&
+    /**
+     * Invoke \c func(i) for each \c i in <tt>[0, count)</tt>, where the
+     * calling thread performs <tt>i = 0</tt> and the pool threads the
+     * others, and return once all invocations have finished. Exceptions
+     * are propagated to the caller.
+     */
+    void run(uint32_t count, const std::function<void(uint32_t)> &func) {
+        std::unique_lock<std::mutex> busy(m_busy, std::try_to_lock);
+        if (!busy.owns_lock() || m_threads.empty()) {
+            for (uint32_t i = 0; i < count; ++i)
+                func(i);
+            return;
+        }
 
-          sigma.shape.size() == 2 &&
-          sigma.dtype == Tensor::Float32 &&
+        std::unique_lock<std::mutex> guard(m_mutex);
+        m_func = &func;
+        m_count = count;
+        m_next = 1;
+        m_pending = count;
+        m_error = nullptr;
+        guard.unlock();
+        m_wakeup.notify_all();
+
+        /* The caller processes the first invocation and helps with the rest */
+        invoke(0);
+        guard.lock();
+        while (m_next < m_count) {
+            uint32_t i = m_next++;
+            guard.unlock();
+            invoke(i);
+            guard.lock();
+        }
+        m_done.wait(guard, [&]() { return m_pending == 0; });
+        m_count = m_next = 0;
+        m_func = nullptr;
 
-          vndf.shape.size() == 4 &&
-          vndf.dtype == Tensor::Float32 &&
-          vndf.shape[0] == phi_i.shape[0] &&
-          vndf.shape[1] == theta_i.shape[0] &&
+        if (m_error)
+            std::rethrow_exception(m_error);
+    }
 
-          luminance.shape.size() == 4 &&
-          luminance.dtype == Tensor::Float32 &&
-          luminance.shape[0] == phi_i.shape[0] &&
-          luminance.shape[1] == theta_i.shape[0] &&
-          luminance.shape[2] == luminance.shape[3] &&
+private:
+    ThreadPool(uint32_t size) {
+        for (uint32_t i = 0; i < size; ++i)
+            m_threads.emplace_back([this]() { loop(); });
+    }
 
-          spectra.dtype == Tensor::Float32 &&
-          spectra.shape.size() == 5 &&
-          spectra.shape[0] == phi_i.shape[0] &&
-          spectra.shape[1] == theta_i.shape[0] &&
-          spectra.shape[2] == wavelengths.shape[0] &&
-          spectra.shape[3] == spectra.shape[4] &&
+    void loop() {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        while (true) {
+            m_wakeup.wait(guard, [&]() { return m_stop || m_next < m_count; });
+            if (m_stop)
+                return;
+            uint32_t i = m_next++;
+            guard.unlock();
+            invoke(i);
+            guard.lock();
+        }
+    }
 
-          luminance.shape[2] == spectra.shape[3] &&
-          luminance.shape[3] == spectra.shape[4] &&
+    /// Perform invocation \c i of the current call and record its completion
+    void invoke(uint32_t i) {
+        std::exception_ptr error;
+        try {
+            (*m_func)(i);
+        } catch (...) {
+            error = std::current_exception();
+        }
 
-          jacobian.shape.size() == 1 &&
-          jacobian.shape[0] == 1 &&
-          jacobian.dtype == Tensor::UInt8))
-            throw std::runtime_error("Invalid file structure: " + tf.to_string());
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (error && !m_error)
+            m_error = error;
+        if (--m_pending == 0)
+            m_done.notify_all();
+    }
 
-    m_data = std::unique_ptr<BRDF::Data>(new BRDF::Data());
+    std::vector<std::thread> m_threads;
+    std::mutex m_busy, m_mutex;
+    std::condition_variable m_wakeup, m_done;
+    const std::function<void(uint32_t)> *m_func = nullptr;
+    uint32_t m_count = 0, m_next = 0, m_pending = 0;
+    std::exception_ptr m_error;
+    bool m_stop = false;
+};
 
-    m_data->isotropic = phi_i.shape[0] <= 2;
-    m_data->jacobian  = ((uint8_t *) jacobian.data.get())[0];
+/**
+ * Invoke \c func(begin, end) for consecutive chunks of <tt>[0, count)</tt>
+ * with at most \c chunk_size elements on \c threads workers (0: one per
+ * hardware thread) of the \c ThreadPool. Each worker initially owns a contiguous range of chunks
+ * that it processes from the front. Once it runs out of work, it steals the
+ * back half of the largest range that is left to another worker.
+ */
+template <typename Func>
+void parallel_chunks(size_t count, size_t chunk_size, uint32_t threads,
+                     const Func &func) {
+    chunk_size = std::max(chunk_size, (size_t) 1);
+    size_t chunks = (count + chunk_size - 1) / chunk_size;
+    if (threads == 0)
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    threads = (uint32_t) std::min((size_t) threads, chunks);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; i += chunk_size)
+            func(i, std::min(i + chunk_size, count));
+        return;
+    }
 
-    if (!m_data->isotropic) {
-        float *phi_i_data = (float *) phi_i.data.get();
-        int reduction = (int) std::rint((2 * Pi) /
-            (phi_i_data[phi_i.shape[0] - 1] - phi_i_data[0]));
-        if (reduction != 1)
-            throw std::runtime_error("reduction != 1, not supported by this implementation");
+    /* Range of chunks owned by each worker (one cache line each) */
+    struct alignas(64) Range {
+        std::mutex mutex;
+        size_t begin, end;
+    };
+    std::vector<Range, AlignedAllocator<Range>> ranges(threads);
+    for (uint32_t i = 0; i < threads; ++i) {
+        ranges[i].begin = chunks * i / threads;
+        ranges[i].end = chunks * (i + 1) / threads;
     }
 
-    /* Construct NDF interpolant data structure */
-    m_data->ndf = Warp2D0(
-        Vector2u(ndf.shape[1], ndf.shape[0]),
-        (float *) ndf.data.get(),
-        { }, { }, false, false
-    );
+    auto worker = [&](uint32_t self) {
+        Range &own = ranges[self];
+        while (true) {
+            size_t chunk;
+            {
+                std::lock_guard<std::mutex> guard(own.mutex);
+                chunk = own.begin < own.end ? own.begin++ : (size_t) -1;
+            }
 
-    /* Construct projected surface area interpolant data structure */
-    m_data->sigma = Warp2D0(
-        Vector2u(sigma.shape[1], sigma.shape[0]),
-        (float *) sigma.data.get(),
-        { }, { }, false, false
-    );
+            if (chunk != (size_t) -1) {
+                size_t begin = chunk * chunk_size;
+                func(begin, std::min(begin + chunk_size, count));
+                continue;
+            }
 
-    /* Construct VNDF warp data structure */
-    m_data->vndf = Warp2D2(
-        Vector2u(vndf.shape[3], vndf.shape[2]),
-        (float *) vndf.data.get(),
-        {{ (uint32_t) phi_i.shape[0],
-           (uint32_t) theta_i.shape[0] }},
-        {{ (const float *) phi_i.data.get(),
-           (const float *) theta_i.data.get() }}
-    );
+            /* Steal from the worker with the most remaining chunks */
+            uint32_t victim = self;
+            size_t most = 0;
+            for (uint32_t i = 0; i < threads; ++i) {
+                if (i == self)
+                    continue;
+                std::lock_guard<std::mutex> guard(ranges[i].mutex);
+                size_t remaining = ranges[i].end - ranges[i].begin;
+                if (remaining > most) {
+                    most = remaining;
+                    victim = i;
+                }
+            }
+            if (most == 0)
+                break;
 
-    /* Construct Luminance warp data structure */
-    m_data->luminance = Warp2D2(
-        Vector2u(luminance.shape[3], luminance.shape[2]),
-        (float *) luminance.data.get(),
-        {{ (uint32_t) phi_i.shape[0],
-           (uint32_t) theta_i.shape[0] }},
-        {{ (const float *) phi_i.data.get(),
-           (const float *) theta_i.data.get() }}
-    );
+            /* Lock both ranges at once (thieves may target each other) */
+            std::unique_lock<std::mutex> guard_victim(ranges[victim].mutex, std::defer_lock),
+                                         guard_own(own.mutex, std::defer_lock);
+            std::lock(guard_victim, guard_own);
 
-    /* Copy wavelength information */
-    size_t size = wavelengths.shape[0];
-    m_data->wavelengths.resize(size);
-    for (size_t i = 0; i < size; ++i)
-        m_data->wavelengths[i] = ((const float *) wavelengths.data.get())[i];
-
-    /* Construct spectral interpolant */
-    m_data->spectra = Warp2D3(
-        Vector2u(spectra.shape[4], spectra.shape[3]),
-        (float *) spectra.data.get(),
-        {{ (uint32_t) phi_i.shape[0],
-           (uint32_t) theta_i.shape[0],
-           (uint32_t) wavelengths.shape[0] }},
-        {{ (const float *) phi_i.data.get(),
-           (const float *) theta_i.data.get(),
-           (const float *) wavelengths.data.get() }},
-        false, false
-    );
-}
+            size_t remaining = ranges[victim].end - ranges[victim].begin;
+            if (remaining == 0)
+                continue;
+            size_t mid = ranges[victim].end - (remaining + 1) / 2;
+
+            own.begin = mid;
+            own.end = ranges[victim].end;
+            ranges[victim].end = mid;
+        }
+    };
 
-BRDF::~BRDF() { }
+    ThreadPool::instance().run(threads, worker);
+}
 
 // *****************************************************************************
-// PDF interface
+// NUMA replication
 // *****************************************************************************
 
-/// Numerically more robust way of evaluating 'std::acos(d.z())'
-inline float elevation(const Vector3f &d) {
-    return 2.f * asin(.5f * std::sqrt(sqr(d.x()) + sqr(d.y()) + sqr(d.z() - 1.f)));
+/// Parse a Linux CPU/node list such as "0-3,8-11"
+inline std::vector<uint32_t> parse_cpu_list(const std::string &str) {
+    std::vector<uint32_t> result;
+    std::istringstream is(str);
+    std::string range;
+    while (std::getline(is, range, ',')) {
+        size_t dash = range.find('-');
+        try {
+            uint32_t first = (uint32_t) std::stoul(range.substr(0, dash)),
+                     last = dash == std::string::npos
+                                ? first : (uint32_t) std::stoul(range.substr(dash + 1));
+            for (uint32_t i = first; i <= last; ++i)
+                result.push_back(i);
+        } catch (const std::exception &) { }
+    }
+    return result;
 }
 
-float BRDF::pdf(const Vector3f &wi, const Vector3f &wo) const {
-    if (wi.z() <= 0 || wo.z() <= 0)
-        return 0;
+/// NUMA nodes of the machine and the CPUs that belong to them (Linux only)
+class NumaTopology {
+public:
+    /// Number of calls between updates of the node returned by \c cached_node()
+    static constexpr uint32_t NodeRefreshInterval = 1024;
 
-    Vector3f wm = normalize(wi + wo);
+    static const NumaTopology &instance() {
+        static NumaTopology topology;
+        return topology;
+    }
 
-    /* Cartesian -> spherical coordinates */
-    float theta_i = elevation(wi),
-          phi_i   = std::atan2(wi.y(), wi.x()),
-          theta_m = elevation(wm),
-          phi_m   = std::atan2(wm.y(), wm.x());
+    /// Return the number of NUMA nodes (1 if unknown)
+    uint32_t node_count() const {
+        return std::max((uint32_t) m_node_cpus.size(), 1u);
+    }
 
-    /* Spherical coordinates -> unit coordinate system */
-    Vector2f u_wm = Vector2f(
-        theta2u(theta_m),
-        phi2u(m_data->isotropic ? (phi_m - phi_i) : phi_m)
-    );
-    u_wm.y() = u_wm.y() - std::floor(u_wm.y());
+    /// Return the index of the node that the calling thread currently runs on
+    uint32_t current_node() const {
+    #if defined(__linux__)
+        int cpu = sched_getcpu();
+        if (cpu >= 0 && (size_t) cpu < m_cpu_node.size())
+            return m_cpu_node[cpu];
+    #endif
+        return 0;
+    }
 
-    Vector2f sample;
-    float vndf_pdf, params[2] = { phi_i, theta_i };
-    std::tie(sample, vndf_pdf) = m_data->vndf.invert(u_wm, params);
+    /**
+     * Variant of \c current_node() for the query path. Threads rarely migrate
+     * between nodes, hence the node is cached per thread and only determined
+     * anew every \c NodeRefreshInterval calls.
+     */
+    uint32_t cached_node() const {
+        static thread_local uint32_t node = 0, countdown = 0;
+        if (countdown-- == 0) {
+            node = current_node();
+            countdown = NodeRefreshInterval - 1;
+        }
+        return node;
+    }
 
-    float pdf = 1.f;
-    #if POWITACQ_SAMPLE_LUMINANCE
-        pdf = m_data->luminance.eval(sample, params);
+    /**
+     * Run \c func on a thread that is bound to the CPUs of \c node, so that
+     * the memory it allocates and touches first is placed on that node
+     */
+    template <typename Func> std::future<void> run_on(uint32_t node, const Func &func) const {
+        return std::async(std::launch::async, [this, node, func]() {
+        #if defined(__linux__)
+            if (node < m_node_cpus.size()) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                for (uint32_t cpu : m_node_cpus[node])
+                    if (cpu < CPU_SETSIZE)
+                        CPU_SET(cpu, &set);
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            }
+        #endif
+            func();
+        });
+    }
+
+private:
+    NumaTopology() {
+    #if defined(__linux__)
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string line;
+        if (!std::getline(online, line))
+            return;
+
+        for (uint32_t id : parse_cpu_list(line)) {
+            std::ifstream cpulist("/sys/devices/system/node/node" +
+                                  std::to_string(id) + "/cpulist");
+            if (!std::getline(cpulist, line))
+                continue;
+            std::vector<uint32_t> cpus = parse_cpu_list(line);
+            if (cpus.empty())
+                continue; /* Memory-only node */
+
+            uint32_t index = (uint32_t) m_node_cpus.size();
+            for (uint32_t cpu : cpus) {
+                if (cpu >= m_cpu_node.size())
+                    m_cpu_node.resize(cpu + 1, 0);
+                m_cpu_node[cpu] = index;
+            }
+            m_node_cpus.push_back(std::move(cpus));
+        }
     #endif
+    }
 
-    float sin_theta_m = std::sqrt(sqr(wm.x()) + sqr(wm.y()));
-    float jacobian = std::max(2.f * sqr(Pi) * u_wm.x() *
-                              sin_theta_m, 1e-6f) * 4.f * dot(wi, wm);
+private:
+    /// CPUs of each node
+    std::vector<std::vector<uint32_t>> m_node_cpus;
 
-    return vndf_pdf * pdf / jacobian;
+    /// Node index of each CPU
+    std::vector<uint32_t> m_cpu_node;
+};
+
+/**
+ * Place a copy of the tables of all levels in \c levels on NUMA nodes 1, 2,
+ * .., which is stored in \c replicas[n - 1]. Each copy resides in an arena of
+ * \c capacity bytes (taken from \c upstream) whose pages are allocated on the
+ * target node. The original tables are expected to reside on node 0.
+ */
+template <typename Levels>
+void replicate_numa(const Levels &levels, std::vector<Levels> &replicas,
+                    std::vector<std::unique_ptr<Arena>> &arenas,
+                    size_t capacity, MemoryResource *upstream) {
+    const NumaTopology &topology = NumaTopology::instance();
+    uint32_t nodes = topology.node_count();
+    if (nodes < 2 || levels.empty())
+        return;
+
+    replicas.resize(nodes - 1);
+    arenas.resize(nodes - 1);
+    std::vector<std::future<void>> tasks;
+    for (uint32_t node = 1; node < nodes; ++node) {
+        tasks.push_back(topology.run_on(node, [&, node]() {
+            arenas[node - 1].reset(new Arena(capacity, upstream));
+            arenas[node - 1]->touch();
+            for (const auto &level : levels)
+                replicas[node - 1].emplace_back(level, arenas[node - 1].get());
+        }));
+    }
+    for (auto &task : tasks)
+        task.get();
 }
 
 // *****************************************************************************
-// Eval interface
+// Spectral basis
 // *****************************************************************************
 
-Spectrum BRDF::eval(const Vector3f &wi, const Vector3f &wo) const {
-    if (wi.z() <= 0 || wo.z() <= 0)
-        return zero();
-
-    Vector3f wm = normalize(wi + wo);
-
-    /* Cartesian -> spherical coordinates */
-    float theta_i = elevation(wi),
-          phi_i   = std::atan2(wi.y(), wi.x()),
-          theta_m = elevation(wm),
-          phi_m   = std::atan2(wm.y(), wm.x());
-
-    /* Spherical coordinates -> unit coordinate system */
-    Vector2f u_wi = Vector2f(theta2u(theta_i), phi2u(phi_i));
-    Vector2f u_wm = Vector2f(
-        theta2u(theta_m),
-        phi2u(m_data->isotropic ? (phi_m - phi_i) : phi_m)
-    );
-    u_wm.y() = u_wm.y() - std::floor(u_wm.y());
+/// Largest supported number of coefficients of the spectral basis
+static constexpr uint32_t MaxSpectralBasisSize = 16;
 
-    Vector2f sample;
-    float vndf_pdf, params[2] = { phi_i, theta_i };
-    std::tie(sample, vndf_pdf) = m_data->vndf.invert(u_wm, params);
+/**
+ * Diagonalize the symmetric n x n matrix \c a (row-major) using cyclic Jacobi
+ * rotations. On return, the diagonal of \c a holds the eigenvalues, and the
+ * columns of \c v hold the associated eigenvectors.
+ */
+inline void jacobi_eigen(size_t n, std::vector<double> &a, std::vector<double> &v) {
+    v.assign(n * n, 0.0);
+    for (size_t i = 0; i < n; ++i)
+        v[i * n + i] = 1.0;
+
+    double norm = 0.0;
+    for (double value : a)
+        norm += value * value;
+
+    for (int sweep = 0; sweep < 50; ++sweep) {
+        double off = 0.0;
+        for (size_t p = 0; p < n; ++p)
+            for (size_t q = p + 1; q < n; ++q)
+                off += a[p * n + q] * a[p * n + q];
+        if (off <= 1e-24 * norm)
+            break;
+
+        for (size_t p = 0; p < n; ++p) {
+            for (size_t q = p + 1; q < n; ++q) {
+                double apq = a[p * n + q];
+                if (apq == 0.0)
+                    continue;
+
+                double theta = (a[q * n + q] - a[p * n + p]) / (2.0 * apq),
+                       t = (theta >= 0 ? 1.0 : -1.0) /
+                           (std::abs(theta) + std::sqrt(theta * theta + 1.0)),
+                       c = 1.0 / std::sqrt(t * t + 1.0),
+                       s = t * c;
+
+                for (size_t k = 0; k < n; ++k) {
+                    double akp = a[k * n + p], akq = a[k * n + q];
+                    a[k * n + p] = c * akp - s * akq;
+                    a[k * n + q] = s * akp + c * akq;
+                }
 
-    Spectrum fr = zero();
-    for (int i = 0; i < (int) m_data->wavelengths.size(); ++i) {
-        float params_fr[3] = { phi_i, theta_i, m_data->wavelengths[i] };
+                for (size_t k = 0; k < n; ++k) {
+                    double apk = a[p * n + k], aqk = a[q * n + k];
+                    a[p * n + k] = c * apk - s * aqk;
+                    a[q * n + k] = s * apk + c * aqk;
+                }
 
-        fr[i] = m_data->spectra.eval(sample, params_fr);
+                for (size_t k = 0; k < n; ++k) {
+                    double vkp = v[k * n + p], vkq = v[k * n + q];
+                    v[k * n + p] = c * vkp - s * vkq;
+                    v[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
     }
+}
 
-    fr *= m_data->ndf.eval(u_wm, params) /
-            (4 * m_data->sigma.eval(u_wi, params));
+/**
+ * Compute an orthonormal basis of \c basis_size vectors that best represents
+ * (in the least squares sense) the spectra stored in a table with layout
+ * [slice][wavelength][texel], and project the table onto it. Returns the
+ * basis (layout [wavelength][coefficient]) and writes the coefficients to
+ * \c coeffs (layout [slice][coefficient][texel]).
+ */
+inline FloatStorage spectral_basis(const float *data, size_t slices,
+                                   size_t wavelengths, size_t texels,
+                                   uint32_t basis_size, FloatStorage &coeffs) {
+    const size_t n = wavelengths;
+
+    /* Accumulate the (uncentered) second moment matrix of all spectra */
+    std::vector<double> moments(n * n, 0.0);
+    std::mutex mutex;
+    parallel_for(slices, [&](size_t slice) {
+        const float *values = data + slice * n * texels;
+        std::vector<double> local(n * n, 0.0);
+        for (size_t t = 0; t < texels; ++t) {
+            for (size_t i = 0; i < n; ++i) {
+                double vi = values[i * texels + t];
+                for (size_t j = i; j < n; ++j)
+                    local[i * n + j] += vi * values[j * texels + t];
+            }
+        }
 
-    return fr;
+        std::lock_guard<std::mutex> guard(mutex);
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = i; j < n; ++j)
+                moments[i * n + j] += local[i * n + j];
+    });
+
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j < i; ++j)
+            moments[i * n + j] = moments[j * n + i];
+
+    /* Principal components: eigenvectors with the largest eigenvalues */
+    std::vector<double> vectors;
+    jacobi_eigen(n, moments, vectors);
+
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t i, size_t j) {
+        return moments[i * n + i] > moments[j * n + j];
+    });
+
+    FloatStorage basis(n * basis_size);
+    for (size_t i = 0; i < n; ++i)
+        for (uint32_t k = 0; k < basis_size; ++k)
+            basis[i * basis_size + k] = (float) vectors[i * n + order[k]];
+
+    /* Project the spectra onto the basis */
+    coeffs = FloatStorage(slices * basis_size * texels);
+    parallel_for(slices, [&](size_t slice) {
+        const float *values = data + slice * n * texels;
+        float *out = coeffs.data() + slice * basis_size * texels;
+        for (uint32_t k = 0; k < basis_size; ++k) {
+            for (size_t t = 0; t < texels; ++t) {
+                double sum = 0.0;
+                for (size_t i = 0; i < n; ++i)
+                    sum += (double) basis[i * basis_size + k] * values[i * texels + t];
+                out[k * texels + t] = (float) sum;
+            }
+        }
+    });
+
+    return basis;
 }
 
 // *****************************************************************************
-// Sample interface
+// Level of detail
 // *****************************************************************************
 
-Spectrum BRDF::sample(const Vector2f &u, const Vector3f &wi,
-                      Vector3f *wo_out, float *pdf_out) const {
-    if (wi.z() <= 0) {
-        if (wo_out)
-            *wo_out = Vector3f(0.f);
-        if (pdf_out)
-            *pdf_out = 0;
-        return zero();
-    }
+/// Resolution of the next coarser level of detail of a 2D table
+inline Vector2u coarser(const Vector2u &size) {
+    return Vector2u(std::max(2u, (size.x() + 1) / 2),
+                    std::max(2u, (size.y() + 1) / 2));
+}
 
-    float theta_i = elevation(wi),
-          phi_i   = std::atan2(wi.y(), wi.x());
+/**
+ * Resample a stack of 2D tables with nodal values (layout [slice][y][x]) to a
+ * coarser resolution. Each coarse node averages the bilinear interpolant of
+ * the fine table using a tent filter that spans the coarse node spacing,
+ * which reduces to the [1 2 1] / 4 kernel when the resolution is halved
+ * exactly.
+ */
+inline FloatStorage downsample(const float *data, size_t slices,
+                               const Vector2u &size, const Vector2u &new_size) {
+    /* Sparse 1D resampling matrix: (fine node, weight) pairs of each coarse node */
+    auto resampler = [](uint32_t n, uint32_t new_n) {
+        std::vector<std::vector<std::pair<uint32_t, float>>> result(new_n);
+        const float offsets[3] = { -.5f, 0.f, .5f },
+                    weights[3] = { .25f, .5f, .25f };
+
+        for (uint32_t i = 0; i < new_n; ++i) {
+            if (n == new_n) {
+                result[i].emplace_back(i, 1.f);
+                continue;
+            }
+            for (int k = 0; k < 3; ++k) {
+                float pos = clamp((i + offsets[k]) / (new_n - 1), 0.f, 1.f) * (n - 1);
+                uint32_t index = std::min((uint32_t) pos, n - 2);
+                float t = pos - index;
+                result[i].emplace_back(index, weights[k] * (1.f - t));
+                result[i].emplace_back(index + 1, weights[k] * t);
+            }
+        }
+        return result;
+    };
 
-    float params[2] = { phi_i, theta_i };
-    Vector2f u_wi = Vector2f(theta2u(theta_i), phi2u(phi_i));
-    Vector2f sample = Vector2f(u.y(), u.x());
-    float lum_pdf = 1.f;
+    auto rx = resampler(size.x(), new_size.x()),
+         ry = resampler(size.y(), new_size.y());
+
+    FloatStorage result(slices * hprod(new_size));
+    parallel_for(slices, [&](size_t slice) {
+        const float *in = data + slice * hprod(size);
+        float *out = result.data() + slice * hprod(new_size);
+
+        /* Separable filter: horizontal pass, followed by a vertical pass */
+        std::vector<float> rows((size_t) size.y() * new_size.x());
+        for (uint32_t y = 0; y < size.y(); ++y) {
+            for (uint32_t x = 0; x < new_size.x(); ++x) {
+                float sum = 0.f;
+                for (const auto &entry : rx[x])
+                    sum += entry.second * in[y * size.x() + entry.first];
+                rows[y * new_size.x() + x] = sum;
+            }
+        }
+
+        for (uint32_t y = 0; y < new_size.y(); ++y) {
+            for (uint32_t x = 0; x < new_size.x(); ++x) {
+                float sum = 0.f;
+                for (const auto &entry : ry[y])
+                    sum += entry.second * rows[entry.first * new_size.x() + x];
+                out[y * new_size.x() + x] = sum;
+            }
+        }
+    });
+
+    return result;
+}
+
+/**
+ * Construct the coarser levels of detail of a table by repeated downsampling.
+ * The function <tt>make(level, data, size)</tt> constructs the table of the
+ * specified level from the resampled data.
+ */
+template <typename Func>
+void build_levels(uint32_t levels, const float *data, size_t slices,
+                  Vector2u size, const Func &make) {
+    FloatStorage current;
+    for (uint32_t level = 1; level <= levels; ++level) {
+        Vector2u new_size = coarser(size);
+        current = downsample(data, slices, size, new_size);
+        make(level, current.data(), new_size);
+        data = current.data();
+        size = new_size;
+    }
+}
+
+// *****************************************************************************
+// Table construction
+// *****************************************************************************
+
+/**
+ * Tables of a single level of detail. The isotropic specialization drops the
+ * phi_i parameter, which removes the associated interval search and halves
+ * the number of gathers per lookup.
+ */
+template <bool Isotropic> struct LevelTables {
+    /// Number of parameters conditioning the VNDF and luminance tables
+    static constexpr size_t Params = Isotropic ? 1 : 2;
+
+    /// Index of the first parameter among (phi_i, theta_i, channel) that is used
+    static constexpr size_t FirstParam = 2 - Params;
+
+    Warp2D0 ndf;
+    Warp2D0 sigma;
+    Marginal2D<Params> vndf;
+    Marginal2D<Params> luminance;
+    Marginal2D<Params + 1> color;
+
+    LevelTables() = default;
+
+    /// Copy \c other, allocating the tables from \c resource
+    LevelTables(const LevelTables &other, MemoryResource *resource)
+        : ndf(other.ndf, resource), sigma(other.sigma, resource),
+          vndf(other.vndf, resource), luminance(other.luminance, resource),
+          color(other.color, resource) { }
+
+    /// Reference the tables within an image written by \c write()
+    LevelTables(ImageReader &reader)
+        : ndf(reader), sigma(reader), vndf(reader), luminance(reader),
+          color(reader) { }
+
+    /// Append the tables to a position-independent image
+    void write(ImageWriter &writer) const {
+        ndf.write(writer);
+        sigma.write(writer);
+        vndf.write(writer);
+        luminance.write(writer);
+        color.write(writer);
+    }
+
+    size_t memory_usage() const {
+        return sizeof(LevelTables) + ndf.memory_usage() + sigma.memory_usage() +
+               vndf.memory_usage() + luminance.memory_usage() +
+               color.memory_usage();
+    }
+};
+
+/// Tensor data from which the tables of a BRDF are constructed
+struct TableSource {
+    Vector2u ndf_size, sigma_size, vndf_size, luminance_size, color_size;
+    const float *ndf, *sigma, *vndf, *luminance, *color;
+
+    /// Resolution and values of the parameters (phi_i, theta_i, color channel)
+    uint32_t param_res[3];
+    const float *param_values[3];
+};
+
+/// Construct a conditional warp given arrays of parameter resolutions and values
+template <size_t Dimension>
+Marginal2D<Dimension> make_warp(const Vector2u &size, const float *data,
+                                const uint32_t *param_res,
+                                const float *const *param_values,
+                                MemoryResource *resource,
+                                bool normalize = true, bool build_cdf = true) {
+    std::array<uint32_t, Dimension> res;
+    std::array<const float *, Dimension> values;
+    for (size_t i = 0; i < Dimension; ++i) {
+        res[i] = param_res[i];
+        values[i] = param_values[i];
+    }
+    return Marginal2D<Dimension>(size, data, res, values, normalize, build_cdf,
+                                 resource);
+}
+
+/**
+ * Construct the tables of all levels of detail from \c source. The isotropic
+ * specialization only retains the slices associated with the first tabulated
+ * value of phi_i. The color table is skipped when \c color is \c false (e.g.
+ * because it is paged in on demand). The tables are allocated from \c resource
+ * if specified.
+ */
+template <bool Isotropic>
+void build_tables(std::vector<LevelTables<Isotropic>> &levels,
+                  const TableSource &source, bool color,
+                  MemoryResource *resource) {
+    const size_t Params = LevelTables<Isotropic>::Params;
+    const uint32_t *res = source.param_res + LevelTables<Isotropic>::FirstParam;
+    const float *const *values = source.param_values + LevelTables<Isotropic>::FirstParam;
+    uint32_t lod_levels = (uint32_t) levels.size() - 1;
+
+    size_t slices = 1;
+    for (size_t i = 0; i < Params; ++i)
+        slices *= res[i];
+
+    /* The warps are independent of each other: construct the expensive ones
+       on separate threads while the small NDF/sigma tables are built here */
+    auto vndf_task = std::async(std::launch::async, [&]() {
+        /* Construct VNDF warp data structure */
+        levels[0].vndf = make_warp<Params>(source.vndf_size, source.vndf, res, values,
+                                       resource);
+        build_levels(lod_levels, source.vndf, slices, source.vndf_size,
+                     [&](uint32_t level, const float *data, const Vector2u &size) {
+            levels[level].vndf = make_warp<Params>(size, data, res, values, resource);
+        });
+    });
+
+    auto luminance_task = std::async(std::launch::async, [&]() {
+        /* Construct Luminance warp data structure */
+        levels[0].luminance = make_warp<Params>(source.luminance_size,
+                                                source.luminance, res, values,
+                                                resource);
+        build_levels(lod_levels, source.luminance, slices, source.luminance_size,
+                     [&](uint32_t level, const float *data, const Vector2u &size) {
+            levels[level].luminance = make_warp<Params>(size, data, res, values,
+                                                        resource);
+        });
+    });
+
+    auto color_task = std::async(std::launch::async, [&]() {
+        if (!color)
+            return;
+
+        /* Construct color interpolant */
+        levels[0].color = make_warp<Params + 1>(source.color_size, source.color,
+                                               res, values, resource, false, false);
+        build_levels(lod_levels, source.color, slices * res[Params], source.color_size,
+                     [&](uint32_t level, const float *data, const Vector2u &size) {
+            levels[level].color = make_warp<Params + 1>(size, data, res, values,
+                                                       resource, false, false);
+        });
+    });
+
+    /* Construct NDF interpolant data structure */
+    levels[0].ndf = Warp2D0(source.ndf_size, source.ndf, { }, { }, false, false,
+                            resource);
+    build_levels(lod_levels, source.ndf, 1, source.ndf_size,
+                 [&](uint32_t level, const float *data, const Vector2u &size) {
+        levels[level].ndf = Warp2D0(size, data, { }, { }, false, false, resource);
+    });
+
+    /* Construct projected surface area interpolant data structure */
+    levels[0].sigma = Warp2D0(source.sigma_size, source.sigma, { }, { }, false, false,
+                              resource);
+    build_levels(lod_levels, source.sigma, 1, source.sigma_size,
+                 [&](uint32_t level, const float *data, const Vector2u &size) {
+        levels[level].sigma = Warp2D0(size, data, { }, { }, false, false, resource);
+    });
+
+    vndf_task.get();
+    luminance_task.get();
+    color_task.get();
+}
+
+/**
+ * Return the number of bytes that \ref build_tables() allocates from an
+ * \c Arena for the given source and number of coarser levels
+ */
+template <bool Isotropic>
+size_t table_storage_size(const TableSource &source, uint32_t lod_levels, bool color) {
+    const size_t Params = LevelTables<Isotropic>::Params;
+    const uint32_t *res = source.param_res + LevelTables<Isotropic>::FirstParam;
+
+    Vector2u ndf_size = source.ndf_size, sigma_size = source.sigma_size,
+             vndf_size = source.vndf_size, luminance_size = source.luminance_size,
+             color_size = source.color_size;
+
+    size_t result = 0;
+    for (uint32_t level = 0; level <= lod_levels; ++level) {
+        result += Warp2D0::storage_size(ndf_size, nullptr, false) +
+                  Warp2D0::storage_size(sigma_size, nullptr, false) +
+                  Marginal2D<Params>::storage_size(vndf_size, res, true) +
+                  Marginal2D<Params>::storage_size(luminance_size, res, true);
+        if (color)
+            result += Marginal2D<Params + 1>::storage_size(color_size, res, false);
+
+        ndf_size = coarser(ndf_size);
+        sigma_size = coarser(sigma_size);
+        vndf_size = coarser(vndf_size);
+        luminance_size = coarser(luminance_size);
+        color_size = coarser(color_size);
+    }
+    return result;
+}
+
+/// Return the resolution and memory usage of the tables of a level of detail
+template <bool Isotropic> LevelInfo level_info(const LevelTables<Isotropic> &level) {
+    LevelInfo info;
+    info.vndf_resolution[0]  = level.vndf.size().x();
+    info.vndf_resolution[1]  = level.vndf.size().y();
+    info.color_resolution[0] = level.luminance.size().x();
+    info.color_resolution[1] = level.luminance.size().y();
+    info.memory_usage = level.memory_usage();
+    return info;
+}
+
+// *****************************************************************************
+// Channel conversion
+// *****************************************************************************
+
+/// Weights of the sRGB primaries in the luminance (CIE Y) of a linear RGB color
+static const float RGBLuminanceWeights[3] = { 0.2126f, 0.7152f, 0.0722f };
+
+/**
+ * Return weights that map a spectrum tabulated at the given wavelengths (in
+ * nanometers) to its luminance. This uses the analytic fit of the CIE 1931 Y
+ * matching function by Wyman et al. and the trapezoidal rule, and the weights
+ * are normalized so that a constant unit spectrum has unit luminance.
+ */
+inline std::vector<float> spectral_luminance_weights(const float *wavelengths, size_t n) {
+    auto lobe = [](float x, float mu, float sigma_1, float sigma_2) {
+        return std::exp(-.5f * sqr((x - mu) / (x < mu ? sigma_1 : sigma_2)));
+    };
+
+    std::vector<float> weights(n);
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        float lambda = wavelengths[i],
+              y = .821f * lobe(lambda, 568.8f, 46.9f, 40.5f) +
+                  .286f * lobe(lambda, 530.9f, 16.3f, 31.1f),
+              width = n > 1 ? .5f * (wavelengths[std::min(i + 1, n - 1)] -
+                                     wavelengths[i > 0 ? i - 1 : 0]) : 1.f;
+        weights[i] = y * width;
+        sum += weights[i];
+    }
+
+    for (float &weight : weights)
+        weight = sum > 0 ? (float) (weight / sum) : 0.f;
+    return weights;
+}
+
+/**
+ * Collapse the channels of a table with layout [slice][channel][texel] into a
+ * single one by computing a weighted sum
+ */
+inline FloatStorage collapse_channels(const float *data, size_t slices,
+                                      size_t channels, size_t texels,
+                                      const float *weights) {
+    FloatStorage result(slices * texels);
+    parallel_for(slices, [&](size_t slice) {
+        const float *values = data + slice * channels * texels;
+        float *out = result.data() + slice * texels;
+        for (size_t t = 0; t < texels; ++t) {
+            float value = 0.f;
+            for (size_t ch = 0; ch < channels; ++ch)
+                value += weights[ch] * values[ch * texels + t];
+            out[t] = value;
+        }
+    });
+    return result;
+}
+
+/**
+ * Integrate the luminance of each slice of a table with layout
+ * [slice][channel][texel] over the unit square. The integral of the bilinear
+ * interpolant is evaluated exactly using the trapezoidal rule.
+ */
+inline FloatStorage luminance_integrals(const float *data, size_t slices,
+                                        size_t channels, const Vector2u &size,
+                                        const float *weights) {
+    size_t texels = hprod(size);
+    FloatStorage result(slices);
+    parallel_for(slices, [&](size_t slice) {
+        result[slice] = weighted_integral(data + slice * channels * texels,
+                                          channels, size, weights);
+    });
+    return result;
+}
+
+// *****************************************************************************
+// BRDF implementation
+// *****************************************************************************
+
+template <size_t Channels> struct BasicBRDF<Channels>::Data {
+    /// Source of the tables' memory (declared first so that it outlives them)
+    std::shared_ptr<MemoryResource> memory_resource;
+
+    /// Mapped image that holds the tables of attached materials (see \ref attach())
+    std::shared_ptr<const uint8_t> image;
+
+    /// Single block holding all tables and arrays below, and those of the NUMA replicas
+    std::unique_ptr<Arena> arena;
+    std::vector<std::unique_ptr<Arena>> numa_arenas;
+
+    /// Full-resolution tables, followed by successively coarser levels of detail
+    std::vector<LevelTables<false>> levels;
+
+    /// Specialized tables of isotropic materials (used instead of 'levels')
+    std::vector<LevelTables<true>> levels_iso;
+
+    /// Copies of 'levels' or 'levels_iso' on NUMA nodes 1, 2, .. (LoadOptions::numa_replicate)
+    std::vector<std::vector<LevelTables<false>>> numa_levels;
+    std::vector<std::vector<LevelTables<true>>> numa_levels_iso;
+    std::unique_ptr<PagedWarp2D3> color_paged;
+    Spectrum wavelengths;
+    FloatStorage phi_i, theta_i;
+
+    /// Number of channels of the color table
+    uint32_t channels;
+
+    /// Spectral basis (layout [channel][coefficient]), if 'color' stores coefficients
+    uint32_t basis_size = 0;
+    FloatStorage basis;
+
+    /// Integral of the color table's luminance over each slice of the luminance warp
+    FloatStorage luminance_scale;
+
+    bool isotropic;
+    bool isotropic_tables = false;
+    bool jacobian;
+
+    /// Directional albedo at the tabulated incident directions (computed on demand)
+    std::once_flag albedo_once;
+    FloatStorage albedo;
+
+    /// Analytic approximation (fitted on demand)
+    std::once_flag proxy_once;
+    BasicProxy<Channels> proxy;
+
+    /// Return the number of channels (a compile-time constant unless Channels == Dynamic)
+    size_t channel_count() const {
+        return Channels != Dynamic ? Channels : channels;
+    }
+
+    /**
+     * Return the tables of a level of detail (clamped to the coarsest one),
+     * using the NUMA replica that is local to the calling thread if available
+     */
+    const LevelTables<false> &level(uint32_t lod) const {
+        uint32_t node = numa_levels.empty() ? 0 : NumaTopology::instance().cached_node();
+        const auto &tables = node == 0 ? levels : numa_levels[node - 1];
+        return tables[std::min(lod, (uint32_t) tables.size() - 1)];
+    }
+
+    /// Return the isotropic tables of a level of detail (see \ref level())
+    const LevelTables<true> &level_iso(uint32_t lod) const {
+        uint32_t node = numa_levels_iso.empty() ? 0 : NumaTopology::instance().cached_node();
+        const auto &tables = node == 0 ? levels_iso : numa_levels_iso[node - 1];
+        return tables[std::min(lod, (uint32_t) tables.size() - 1)];
+    }
+
+    size_t memory_usage() const {
+        size_t result = sizeof(Data) + wavelengths.size() * sizeof(float) +
+                        basis.size() * sizeof(float) +
+                        luminance_scale.size() * sizeof(float) +
+                        (phi_i.size() + theta_i.size() + albedo.size()) * sizeof(float) +
+                        (color_paged ? color_paged->memory_usage() : 0);
+        for (const auto &level : levels)
+            result += level.memory_usage();
+        for (const auto &level : levels_iso)
+            result += level.memory_usage();
+        for (const auto &replica : numa_levels)
+            for (const auto &level : replica)
+                result += level.memory_usage();
+        for (const auto &replica : numa_levels_iso)
+            for (const auto &level : replica)
+                result += level.memory_usage();
+        return result;
+    }
+};
+
+// *****************************************************************************
+// BRDF convenience functions
+// *****************************************************************************
+
+template <typename Value> Value u2theta(Value u) {
+    return sqr(u) * (Pi / 2.f);
+}
+
+template <typename Value> Value u2phi(Value u) {
+    return (2.f * u - 1.f) * Pi;
+}
+
+template <typename Value> Value theta2u(Value theta) {
+    return std::sqrt(theta * (2.f / Pi));
+}
+
+template <typename Value> Value phi2u(Value phi) {
+    return (phi + Pi) / (2.f * Pi);
+}
+
+/// Return a value with the given number of channels that is zero everywhere
+template <size_t Channels> Color<Channels> zero_color(size_t) {
+    return Color<Channels>(0.f);
+}
+
+template <> inline Spectrum zero_color<Dynamic>(size_t channels) {
+    return Spectrum(0.f, channels);
+}
+
+template <size_t Channels> Color<Channels> BasicBRDF<Channels>::zero() const {
+    return zero_color<Channels>(m_data->channels);
+}
+
+template <size_t Channels> size_t BasicBRDF<Channels>::channels() const {
+    return m_data->channel_count();
+}
+
+template <size_t Channels> const Spectrum &BasicBRDF<Channels>::wavelengths() const {
+    return m_data->wavelengths;
+}
+
+// *****************************************************************************
+// Ctor/dtor
+// *****************************************************************************
+
+template <size_t Channels>
+BasicBRDF<Channels>::BasicBRDF(const std::string &path_to_file,
+                               const LoadOptions &options) {
+    if (options.slice_cache_size > 0) {
+        /* Map the file so that slices can be paged in on demand */
+        size_t size;
+        auto data = map_file(path_to_file, &size);
+        init(Tensor(data, size, path_to_file), options);
+    } else {
+        init(Tensor(path_to_file), options);
+    }
+}
+
+template <size_t Channels>
+BasicBRDF<Channels>::BasicBRDF(const Pack &pack, const std::string &name,
+                               const LoadOptions &options) {
+    init(pack.m_data->tensor(name), options);
+}
+
+template <size_t Channels>
+void BasicBRDF<Channels>::init(const Tensor &tf, const LoadOptions &options) {
+    /* Spectral files tabulate the color data at a set of wavelengths */
+    bool spectral = !tf.has_field("rgb");
+    const char *color_name = spectral ? "spectra" : "rgb";
+
+    auto& theta_i = tf.field("theta_i");
+    auto& phi_i = tf.field("phi_i");
+    auto& ndf = tf.field("ndf");
+    auto& sigma = tf.field("sigma");
+    auto& vndf = tf.field("vndf");
+    auto& color = tf.field(color_name);
+    auto& luminance = tf.field("luminance");
+    auto* wavelengths = spectral ? &tf.field("wavelengths") : nullptr;
+    auto& description = tf.field("description");
+    auto& jacobian = tf.field("jacobian");
+
+    if (!(description.shape.size() == 1 &&
+          description.dtype == Tensor::UInt8 &&
+
+          theta_i.shape.size() == 1 &&
+          theta_i.dtype == Tensor::Float32 &&
+
+          phi_i.shape.size() == 1 &&
+          phi_i.dtype == Tensor::Float32 &&
+
+          (!spectral || (wavelengths->shape.size() == 1 &&
+                         wavelengths->dtype == Tensor::Float32)) &&
+
+          ndf.shape.size() == 2 &&
+          ndf.dtype == Tensor::Float32 &&
+
+          sigma.shape.size() == 2 &&
+          sigma.dtype == Tensor::Float32 &&
+
+          vndf.shape.size() == 4 &&
+          vndf.dtype == Tensor::Float32 &&
+          vndf.shape[0] == phi_i.shape[0] &&
+          vndf.shape[1] == theta_i.shape[0] &&
+
+          luminance.shape.size() == 4 &&
+          luminance.dtype == Tensor::Float32 &&
+          luminance.shape[0] == phi_i.shape[0] &&
+          luminance.shape[1] == theta_i.shape[0] &&
+          luminance.shape[2] == luminance.shape[3] &&
+
+          color.dtype == Tensor::Float32 &&
+          color.shape.size() == 5 &&
+          color.shape[0] == phi_i.shape[0] &&
+          color.shape[1] == theta_i.shape[0] &&
+          color.shape[2] == (spectral ? wavelengths->shape[0] : 3) &&
+          color.shape[3] == color.shape[4] &&
+
+          luminance.shape[2] == color.shape[3] &&
+          luminance.shape[3] == color.shape[4] &&
+
+          jacobian.shape.size() == 1 &&
+          jacobian.shape[0] == 1 &&
+          jacobian.dtype == Tensor::UInt8))
+            throw std::runtime_error("Invalid file structure: " + tf.to_string());
+
+    /* BRDFs with a single channel tabulate the luminance of the file's channels */
+    uint32_t file_channels = (uint32_t) color.shape[2];
+    bool to_luminance = Channels == 1 && file_channels != 1;
+    if (Channels != Dynamic && Channels != 1 && Channels != file_channels)
+        throw std::runtime_error(
+            "BRDF: expected a file with " + std::to_string(Channels) +
+            " channels, but \"" + tf.filename() + "\" has " +
+            std::to_string(file_channels) + " channels" +
+            (spectral ? " (use python/spectral_to_rgb.py to convert spectral files)" : ""));
+    if (to_luminance && options.slice_cache_size > 0)
+        throw std::runtime_error("LoadOptions: slice_cache_size requires a BRDF with the "
+                                 "same number of channels as the file");
+
+    m_data = std::make_shared<Data>();
+
+    /* Only copy the fields of memory-mapped files that are consumed in-core
+       and misaligned. The slices of a paged color table are constructed
+       directly from the mapping. */
+    std::vector<FloatStorage> copies;
+    auto floats = [&](const Tensor::Field &field) { return float_data(field, copies); };
+    const float *phi_i_data = floats(phi_i), *theta_i_data = floats(theta_i),
+                *wavelength_data = spectral ? floats(*wavelengths) : nullptr;
+
+    m_data->isotropic = phi_i.shape[0] <= 2;
+    m_data->jacobian  = ((uint8_t *) jacobian.data.get())[0];
+    m_data->channels  = to_luminance ? 1 : file_channels;
+
+    if (!m_data->isotropic) {
+        int reduction = (int) std::rint((2 * Pi) /
+            (phi_i_data[phi_i.shape[0] - 1] - phi_i_data[0]));
+        if (reduction != 1)
+            throw std::runtime_error("reduction != 1, not supported by this implementation");
+    }
+
+    /* Determine the number of coarser levels of detail */
+    uint32_t lod_levels = 0;
+    Vector2u lod_size = max(Vector2u(vndf.shape[3], vndf.shape[2]),
+                            Vector2u(color.shape[4], color.shape[3]));
+    while (lod_levels < options.lod_levels && (lod_size.x() > 2 || lod_size.y() > 2)) {
+        lod_size = coarser(lod_size);
+        lod_levels++;
+    }
+    if (lod_levels > 0 && options.slice_cache_size > 0)
+        throw std::runtime_error("LoadOptions: lod_levels and slice_cache_size "
+                                 "cannot be combined");
+
+    uint32_t basis_size = options.spectral_basis_size;
+    if (basis_size > 0 && (basis_size < 2 || basis_size > MaxSpectralBasisSize ||
+                           basis_size > m_data->channels))
+        throw std::runtime_error("LoadOptions: spectral_basis_size must be between 2 and "
+                                 "the number of channels (at most 16)");
+    if (basis_size > 0 && options.slice_cache_size > 0)
+        throw std::runtime_error("LoadOptions: spectral_basis_size and slice_cache_size "
+                                 "cannot be combined");
+
+    /* Isotropic materials use specialized tables without the phi_i parameter
+       (the out-of-core interpolant only exists in the general form) */
+    m_data->isotropic_tables = m_data->isotropic && options.slice_cache_size == 0;
+
+    /* The color table is conditioned on the channel index */
+    FloatStorage indices(file_channels);
+    for (uint32_t i = 0; i < file_channels; ++i)
+        indices[i] = (float) i;
+
+    TableSource source;
+    source.ndf_size       = Vector2u(ndf.shape[1], ndf.shape[0]);
+    source.sigma_size     = Vector2u(sigma.shape[1], sigma.shape[0]);
+    source.vndf_size      = Vector2u(vndf.shape[3], vndf.shape[2]);
+    source.luminance_size = Vector2u(luminance.shape[3], luminance.shape[2]);
+    source.color_size     = Vector2u(color.shape[4], color.shape[3]);
+    source.ndf            = floats(ndf);
+    source.sigma          = floats(sigma);
+    source.vndf           = floats(vndf);
+    source.luminance      = floats(luminance);
+    source.color          = options.slice_cache_size > 0
+                                ? (const float *) color.data.get() : floats(color);
+    source.param_res[0]    = (uint32_t) phi_i.shape[0];
+    source.param_res[1]    = (uint32_t) theta_i.shape[0];
+    source.param_res[2]    = m_data->channels;
+    source.param_values[0] = phi_i_data;
+    source.param_values[1] = theta_i_data;
+    source.param_values[2] = indices.data();
+
+    size_t slices = (m_data->isotropic_tables ? 1 : phi_i.shape[0]) * theta_i.shape[0],
+           texels = color.shape[3] * color.shape[4];
+
+    /* Precompute the layout of all storage, which is then carved out of a
+       single block allocated from the memory resource (if specified) */
+    uint32_t color_res = basis_size > 0 ? basis_size : m_data->channels;
+    source.param_res[2] = color_res;
+    size_t tables_size = m_data->isotropic_tables
+        ? table_storage_size<true>(source, lod_levels, true)
+        : table_storage_size<false>(source, lod_levels, options.slice_cache_size == 0);
+    size_t arena_capacity = tables_size +
+        arena_size(phi_i.shape[0]) + arena_size(theta_i.shape[0]) +
+        (options.slice_cache_size == 0 ? arena_size(slices) : 0) +
+        arena_size((size_t) m_data->channels * basis_size) +
+        arena_size(phi_i.shape[0] * theta_i.shape[0] * m_data->channels);
+    source.param_res[2] = m_data->channels;
+
+    m_data->memory_resource = options.memory_resource;
+    bool replicate = options.numa_replicate && NumaTopology::instance().node_count() > 1;
+    auto make_arena = [&]() {
+        m_data->arena.reset(new Arena(arena_capacity, m_data->memory_resource.get()));
+        /* Place the pages of the original tables on NUMA node 0 if they are replicated */
+        if (replicate)
+            m_data->arena->touch();
+    };
+    if (replicate)
+        NumaTopology::instance().run_on(0, make_arena).get();
+    else
+        make_arena();
+    MemoryResource *arena = m_data->arena.get();
+
+    /* Keep track of the incident directions at which the tables are discretized */
+    m_data->phi_i = copy_storage(phi_i_data, phi_i_data + phi_i.shape[0], arena);
+    m_data->theta_i = copy_storage(theta_i_data, theta_i_data + theta_i.shape[0], arena);
+
+    std::vector<float> weights = spectral
+        ? spectral_luminance_weights(wavelength_data, file_channels)
+        : std::vector<float>(RGBLuminanceWeights, RGBLuminanceWeights + 3);
+
+    /* The luminance warp is normalized per slice; record the integral of the
+       color table's luminance to evaluate it in absolute terms. Paged color
+       tables compute it when a slice is paged in instead of reading the
+       whole table here. */
+    if (options.slice_cache_size == 0) {
+        FloatStorage scale = luminance_integrals(source.color, slices, file_channels,
+                                                 source.color_size, weights.data());
+        m_data->luminance_scale = copy_storage(scale.data(), scale.data() + scale.size(),
+                                               arena);
+    }
+
+    FloatStorage luminance_data;
+    if (to_luminance) {
+        luminance_data = collapse_channels(source.color, slices, file_channels,
+                                           texels, weights.data());
+        source.color = luminance_data.data();
+    }
+
+    FloatStorage coeffs;
+    if (basis_size > 0) {
+        /* Project the spectra onto a low-rank basis, and tabulate the coefficients instead */
+        m_data->basis_size = basis_size;
+        FloatStorage basis = spectral_basis(source.color, slices, m_data->channels,
+                                            texels, basis_size, coeffs);
+        m_data->basis = copy_storage(basis.data(), basis.data() + basis.size(), arena);
+
+        source.color = coeffs.data();
+        source.param_res[2] = basis_size;
+    }
+
+    if (options.slice_cache_size > 0) {
+        /* Construct out-of-core color interpolant */
+        m_data->color_paged.reset(new PagedWarp2D3(
+            source.color_size,
+            tf.source(color_name),
+            {{ source.param_res[0], source.param_res[1], source.param_res[2] }},
+            {{ source.param_values[0], source.param_values[1], source.param_values[2] }},
+            options.slice_cache_size,
+            weights.data()
+        ));
+    }
+
+    if (m_data->isotropic_tables) {
+        m_data->levels_iso.resize(lod_levels + 1);
+        build_tables(m_data->levels_iso, source, true, arena);
+    } else {
+        m_data->levels.resize(lod_levels + 1);
+        build_tables(m_data->levels, source, !m_data->color_paged, arena);
+    }
+
+    if (replicate) {
+        replicate_numa(m_data->levels, m_data->numa_levels, m_data->numa_arenas,
+                       tables_size, m_data->memory_resource.get());
+        replicate_numa(m_data->levels_iso, m_data->numa_levels_iso, m_data->numa_arenas,
+                       tables_size, m_data->memory_resource.get());
+    }
+
+    /* Copy wavelength information */
+    if (spectral && !to_luminance) {
+        size_t size = wavelengths->shape[0];
+        m_data->wavelengths.resize(size);
+        for (size_t i = 0; i < size; ++i)
+            m_data->wavelengths[i] = wavelength_data[i];
+    }
+}
+
+template <size_t Channels>
+BasicBRDF<Channels>::BasicBRDF(const std::shared_ptr<Data> &data) : m_data(data) { }
+template <size_t Channels> BasicBRDF<Channels>::BasicBRDF(const BasicBRDF &) = default;
+template <size_t Channels> BasicBRDF<Channels>::BasicBRDF(BasicBRDF &&) = default;
+template <size_t Channels>
+BasicBRDF<Channels> &BasicBRDF<Channels>::operator=(const BasicBRDF &) = default;
+template <size_t Channels>
+BasicBRDF<Channels> &BasicBRDF<Channels>::operator=(BasicBRDF &&) = default;
+template <size_t Channels> BasicBRDF<Channels>::~BasicBRDF() { }
+
+template <size_t Channels>
+std::future<BasicBRDF<Channels>>
+BasicBRDF<Channels>::load_async(const std::string &path_to_file,
+                                const LoadOptions &options) {
+    return std::async(std::launch::async, [path_to_file, options]() {
+        return BasicBRDF(path_to_file, options);
+    });
+}
+
+// *****************************************************************************
+// Sharing materials between processes
+// *****************************************************************************
+
+template <size_t Channels>
+void BasicBRDF<Channels>::publish(const std::string &path) const {
+    const Data &d = *m_data;
+    if (d.color_paged)
+        throw std::runtime_error("BRDF::publish(): materials with a slice cache "
+                                 "cannot be published");
+
+    auto write = [&](ImageWriter &writer) {
+        writer.write(ImageMagic, sizeof(ImageMagic));
+        writer.write(ImageVersion);
+        writer.write((uint32_t) Channels);
+        writer.write(d.channels);
+        writer.write(d.basis_size);
+        writer.write((uint8_t) d.isotropic);
+        writer.write((uint8_t) d.isotropic_tables);
+        writer.write((uint8_t) d.jacobian);
+        writer.write((uint32_t) (d.levels.size() + d.levels_iso.size()));
+
+        writer.write_array(d.wavelengths.size() > 0 ? &d.wavelengths[0] : nullptr,
+                           d.wavelengths.size());
+        writer.write(d.phi_i);
+        writer.write(d.theta_i);
+        writer.write(d.basis);
+        writer.write(d.luminance_scale);
+        for (const auto &level : d.levels)
+            level.write(writer);
+        for (const auto &level : d.levels_iso)
+            level.write(writer);
+    };
+
+    /* Determine the size of the image, then fill it */
+    ImageWriter counter;
+    write(counter);
+    FloatStorage buffer((counter.size() + sizeof(float) - 1) / sizeof(float));
+    ImageWriter writer((uint8_t *) buffer.data());
+    write(writer);
+
+    /* Write to a temporary file that is then renamed, so that concurrent
+       calls to attach() never observe a partially written image */
+#if !defined(_WIN32)
+    std::string tmp_path = path + ".tmp" + std::to_string(getpid());
+#else
+    std::string tmp_path = path + ".tmp";
+#endif
+    std::ofstream file(tmp_path, std::ios::binary);
+    file.write((const char *) buffer.data(), (std::streamsize) writer.size());
+    file.close();
+    if (!file) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("BRDF::publish(): unable to write " + tmp_path);
+    }
+#if defined(_WIN32)
+    std::remove(path.c_str());
+#endif
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("BRDF::publish(): unable to create " + path);
+    }
+}
+
+template <size_t Channels>
+BasicBRDF<Channels> BasicBRDF<Channels>::attach(const std::string &path) {
+    std::shared_ptr<Data> d = std::make_shared<Data>();
+    size_t size;
+    d->image = map_file(path, &size);
+    ImageReader reader(d->image.get(), size, path);
+
+    char magic[sizeof(ImageMagic)];
+    reader.read(magic, sizeof(magic));
+    if (memcmp(magic, ImageMagic, sizeof(ImageMagic)) != 0)
+        throw std::runtime_error("BRDF::attach(): invalid header: " + path);
+    if (reader.read<uint32_t>() != ImageVersion)
+        throw std::runtime_error("BRDF::attach(): unknown image version: " + path);
+    if (reader.read<uint32_t>() != (uint32_t) Channels)
+        throw std::runtime_error("BRDF::attach(): the image \"" + path +
+                                 "\" was published by a BRDF with a different "
+                                 "number of channels");
+
+    d->channels = reader.read<uint32_t>();
+    d->basis_size = reader.read<uint32_t>();
+    d->isotropic = reader.read<uint8_t>() != 0;
+    d->isotropic_tables = reader.read<uint8_t>() != 0;
+    d->jacobian = reader.read<uint8_t>() != 0;
+    uint32_t level_count = reader.read<uint32_t>();
+
+    FloatStorage wavelengths = reader.read_array();
+    d->wavelengths = Spectrum(wavelengths.data(), wavelengths.size());
+    d->phi_i = reader.read_array();
+    d->theta_i = reader.read_array();
+    d->basis = reader.read_array();
+    d->luminance_scale = reader.read_array();
+
+    if (level_count == 0 || d->phi_i.empty() || d->theta_i.empty())
+        throw std::runtime_error("Invalid material image: " + path);
+
+    /* The tables reference the mapped image in place */
+    for (uint32_t i = 0; i < level_count; ++i) {
+        if (d->isotropic_tables)
+            d->levels_iso.emplace_back(reader);
+        else
+            d->levels.emplace_back(reader);
+    }
+
+    return BasicBRDF(d);
+}
+
+// *****************************************************************************
+// PDF interface
+// *****************************************************************************
+
+/// Polynomial approximation of 'std::atan2(y, x)' (max. abs. error: 2e-6)
+inline float fast_atan2(float y, float x) {
+    float ax = std::abs(x), ay = std::abs(y),
+          a = std::min(ax, ay) / std::max(std::max(ax, ay), 1e-30f),
+          s = a * a;
+
+    float r = a * (.99997726f + s * (-.33262347f + s * (.19354346f +
+              s * (-.11643287f + s * (.05265332f + s * -.01172120f)))));
+
+    r = ay > ax ? (Pi / 2.f - r) : r;
+    r = x < 0.f ? (Pi - r) : r;
+    return y < 0.f ? -r : r;
+}
+
+/// Polynomial approximation of 'std::sin(x)' and 'std::cos(x)' (max. abs. error: 1e-7 for |x| <= 4 pi)
+inline void fast_sincos(float x, float &sin_x, float &cos_x) {
+    /* Reduce to [-pi/4, pi/4] using a three-part representation of pi/2 */
+    float k = std::nearbyint(x * (2.f / Pi)),
+          r = ((x - k * 1.5703125f) - k * 4.837512969970703125e-4f) -
+              k * 7.54978995489188216e-8f,
+          s = r * r;
+
+    float sr = r + r * s * (-1.6666654611e-1f + s * (8.3321608736e-3f +
+               s * -1.9515295891e-4f)),
+          cr = 1.f - .5f * s + s * s * (4.166664568298827e-2f +
+               s * (-1.388731625493765e-3f + s * 2.443315711809948e-5f));
+
+    int q = (int) k;
+    float sv = (q & 1) ? cr : sr,
+          cv = (q & 1) ? sr : cr;
+    sin_x = (q & 2) ? -sv : sv;
+    cos_x = ((q + 1) & 2) ? -cv : cv;
+}
+
+/// Numerically more robust way of evaluating 'std::acos(d.z())'
+inline float elevation(const Vector3f &d) {
+    #if POWITACQ_FAST_MATH
+        return fast_atan2(std::sqrt(sqr(d.x()) + sqr(d.y())), d.z());
+    #else
+        return 2.f * asin(.5f * std::sqrt(sqr(d.x()) + sqr(d.y()) + sqr(d.z() - 1.f)));
+    #endif
+}
+
+/// Evaluate 'std::atan2(d.y(), d.x())'
+inline float azimuth(const Vector3f &d) {
+    #if POWITACQ_FAST_MATH
+        return fast_atan2(d.y(), d.x());
+    #else
+        return std::atan2(d.y(), d.x());
+    #endif
+}
+
+/// Evaluate 'std::sin(x)' and 'std::cos(x)'
+inline void sincos(float x, float &sin_x, float &cos_x) {
+    #if POWITACQ_FAST_MATH
+        fast_sincos(x, sin_x, cos_x);
+    #else
+        sin_x = std::sin(x);
+        cos_x = std::cos(x);
+    #endif
+}
+
+template <size_t Channels> template <typename Tables>
+float BasicBRDF<Channels>::pdf_impl(const Tables &level, const Vector3f &wi,
+                                    const Vector3f &wo) const {
+    if (wi.z() <= 0 || wo.z() <= 0)
+        return 0;
+
+    Vector3f wm = normalize(wi + wo);
+
+    /* Cartesian -> spherical coordinates */
+    float theta_i = elevation(wi),
+          phi_i   = azimuth(wi),
+          theta_m = elevation(wm),
+          phi_m   = azimuth(wm);
+
+    /* Spherical coordinates -> unit coordinate system */
+    Vector2f u_wm = Vector2f(
+        theta2u(theta_m),
+        phi2u(m_data->isotropic ? (phi_m - phi_i) : phi_m)
+    );
+    u_wm.y() = u_wm.y() - std::floor(u_wm.y());
+
+    Vector2f sample;
+    float vndf_pdf, params[2] = { phi_i, theta_i };
+    std::tie(sample, vndf_pdf) = level.vndf.invert(u_wm, params + Tables::FirstParam);
+
+    float pdf = 1.f;
+    #if POWITACQ_SAMPLE_LUMINANCE
+        pdf = level.luminance.eval(sample, params + Tables::FirstParam);
+    #endif
+
+    float sin_theta_m = std::sqrt(sqr(wm.x()) + sqr(wm.y()));
+    float jacobian = std::max(2.f * sqr(Pi) * u_wm.x() *
+                              sin_theta_m, 1e-6f) * 4.f * dot(wi, wm);
+
+    return vndf_pdf * pdf / jacobian;
+}
+
+template <size_t Channels>
+float BasicBRDF<Channels>::pdf(const Vector3f &wi, const Vector3f &wo,
+                               uint32_t lod) const {
+    if (m_data->isotropic_tables)
+        return pdf_impl(m_data->level_iso(lod), wi, wo);
+    else
+        return pdf_impl(m_data->level(lod), wi, wo);
+}
+
+// *****************************************************************************
+// Eval interface
+// *****************************************************************************
+
+template <size_t Channels> template <typename Tables, typename Out>
+void BasicBRDF<Channels>::color(const Tables &level, const Vector2f &sample,
+                                float phi_i, float theta_i, Out &fr) const {
+    const Data &d = *m_data;
+    const size_t channels = d.channel_count();
+    float params[3] = { phi_i, theta_i, 0.f };
+
+    if (d.basis_size > 0) {
+        /* Reconstruct the spectrum from the basis coefficients */
+        float coeffs[MaxSpectralBasisSize];
+        for (uint32_t k = 0; k < d.basis_size; ++k) {
+            params[2] = float(k);
+            coeffs[k] = level.color.eval(sample, params + Tables::FirstParam);
+        }
+
+        const float *basis = d.basis.data();
+        for (size_t i = 0; i < channels; ++i) {
+            float value = 0.f;
+            for (uint32_t k = 0; k < d.basis_size; ++k)
+                value += basis[k] * coeffs[k];
+            fr[i] = value;
+            basis += d.basis_size;
+        }
+    } else if (d.color_paged) {
+        PagedWarp2D3::Slices slices = d.color_paged->slices(params);
+        for (size_t i = 0; i < channels; ++i) {
+            params[2] = float(i);
+            fr[i] = slices.eval(sample, params + 2);
+        }
+    } else {
+        for (size_t i = 0; i < channels; ++i) {
+            params[2] = float(i);
+            fr[i] = level.color.eval(sample, params + Tables::FirstParam);
+        }
+    }
+
+    #if POWITACQ_CLIP_RGB
+        /* clamp the value to zero (negative values occur when the original
+           spectral data goes out of gamut) */
+        if (Channels != Dynamic) {
+            for (size_t i = 0; i < channels; ++i)
+                fr[i] = std::max(0.f, fr[i]);
+        }
+    #endif
+}
+
+template <size_t Channels> template <typename Tables>
+void BasicBRDF<Channels>::color(const Tables &level, const Vector2f &sample,
+                                float phi_i, float theta_i, float &fr) const {
+    float params[2] = { phi_i, theta_i };
+
+    /* The integrals of paged color tables are known once the slices are paged in */
+    const float *scale = m_data->color_paged ? m_data->color_paged->integrals(params)
+                                             : m_data->luminance_scale.data();
+    fr = level.luminance.eval(sample, params + Tables::FirstParam, scale);
+}
+
+template <size_t Channels> template <typename Tables, typename Out>
+void BasicBRDF<Channels>::eval_impl(const Tables &level, const Vector3f &wi,
+                                    const Vector3f &wo, Out &fr) const {
+    if (wi.z() <= 0 || wo.z() <= 0) {
+        set_zero(fr, m_data->channel_count());
+        return;
+    }
+
+    Vector3f wm = normalize(wi + wo);
+
+    /* Cartesian -> spherical coordinates */
+    float theta_i = elevation(wi),
+          phi_i   = azimuth(wi),
+          theta_m = elevation(wm),
+          phi_m   = azimuth(wm);
+
+    /* Spherical coordinates -> unit coordinate system */
+    Vector2f u_wi = Vector2f(theta2u(theta_i), phi2u(phi_i));
+    Vector2f u_wm = Vector2f(
+        theta2u(theta_m),
+        phi2u(m_data->isotropic ? (phi_m - phi_i) : phi_m)
+    );
+    u_wm.y() = u_wm.y() - std::floor(u_wm.y());
+
+    Vector2f sample;
+    float vndf_pdf, params[2] = { phi_i, theta_i };
+    std::tie(sample, vndf_pdf) = level.vndf.invert(u_wm, params + Tables::FirstParam);
+
+    color(level, sample, phi_i, theta_i, fr);
+
+    fr *= level.ndf.eval(u_wm, params) /
+          (4 * level.sigma.eval(u_wi, params));
+}
+
+template <size_t Channels>
+Color<Channels> BasicBRDF<Channels>::eval(const Vector3f &wi, const Vector3f &wo,
+                                          uint32_t lod) const {
+    Value fr = zero();
+    if (m_data->isotropic_tables)
+        eval_impl(m_data->level_iso(lod), wi, wo, fr);
+    else
+        eval_impl(m_data->level(lod), wi, wo, fr);
+    return fr;
+}
+
+template <size_t Channels>
+float BasicBRDF<Channels>::eval_luminance(const Vector3f &wi, const Vector3f &wo,
+                                          uint32_t lod) const {
+    float fr;
+    if (m_data->isotropic_tables)
+        eval_impl(m_data->level_iso(lod), wi, wo, fr);
+    else
+        eval_impl(m_data->level(lod), wi, wo, fr);
+    return fr;
+}
+
+// *****************************************************************************
+// Sample interface
+// *****************************************************************************
+
+template <size_t Channels> template <typename Tables, typename Out>
+void BasicBRDF<Channels>::sample_impl(const Tables &level, const Vector2f &u,
+                                      const Vector3f &wi, Vector3f *wo_out,
+                                      float *pdf_out, Out &fr) const {
+    if (wi.z() <= 0) {
+        if (wo_out)
+            *wo_out = Vector3f(0.f);
+        if (pdf_out)
+            *pdf_out = 0;
+        set_zero(fr, m_data->channel_count());
+        return;
+    }
+
+    float theta_i = elevation(wi),
+          phi_i   = azimuth(wi);
+
+    float params[2] = { phi_i, theta_i };
+    Vector2f sample = Vector2f(u.y(), u.x());
+    float lum_pdf = 1.f;
+
+    #if POWITACQ_SAMPLE_LUMINANCE
+        std::tie(sample, lum_pdf) =
+            level.luminance.sample(sample, params + Tables::FirstParam);
+    #endif
+
+    Vector2f u_wm;
+    float ndf_pdf;
+    std::tie(u_wm, ndf_pdf) =
+        level.vndf.sample(sample, params + Tables::FirstParam);
+
+    sample_finish(level, wi, phi_i, theta_i, sample, lum_pdf, u_wm, ndf_pdf,
+                  wo_out, pdf_out, fr);
+}
+
+template <size_t Channels> template <typename Tables, typename Out>
+void BasicBRDF<Channels>::sample_finish(const Tables &level, const Vector3f &wi,
+                                        float phi_i, float theta_i,
+                                        const Vector2f &sample, float lum_pdf,
+                                        const Vector2f &u_wm, float ndf_pdf,
+                                        Vector3f *wo_out, float *pdf_out,
+                                        Out &fr) const {
+    float params[2] = { phi_i, theta_i };
+    Vector2f u_wi = Vector2f(theta2u(theta_i), phi2u(phi_i));
+
+    float phi_m   = u2phi(u_wm.y()),
+          theta_m = u2theta(u_wm.x());
+
+    if (m_data->isotropic)
+        phi_m += phi_i;
+
+    /* Spherical -> Cartesian coordinates */
+    float sin_phi_m, cos_phi_m, sin_theta_m, cos_theta_m;
+    sincos(phi_m, sin_phi_m, cos_phi_m);
+    sincos(theta_m, sin_theta_m, cos_theta_m);
+
+    Vector3f wm = Vector3f(
+        cos_phi_m * sin_theta_m,
+        sin_phi_m * sin_theta_m,
+        cos_theta_m
+    );
+
+    Vector3f wo = wm * 2.f * dot(wm, wi) - wi;
+    if (wo.z() <= 0) {
+        if (wo_out)
+            *wo_out = Vector3f(0.f);
+        if (pdf_out)
+            *pdf_out = 0;
+        set_zero(fr, m_data->channel_count());
+        return;
+    }
+
+    color(level, sample, phi_i, theta_i, fr);
+
+    fr *= level.ndf.eval(u_wm, params) /
+          (4 * level.sigma.eval(u_wi, params));
+
+    float jacobian = std::max(2.f * sqr(Pi) * u_wm.x() *
+                              sin_theta_m, 1e-6f) * 4.f * dot(wi, wm);
+
+    float pdf = ndf_pdf * lum_pdf / jacobian;
+
+    if (wo_out)  (*wo_out)  = wo;
+    if (pdf_out) (*pdf_out) = pdf;
+
+    fr /= pdf;
+}
+
+template <size_t Channels>
+Color<Channels> BasicBRDF<Channels>::sample(const Vector2f &u, const Vector3f &wi,
+                                            Vector3f *wo_out, float *pdf_out,
+                                            uint32_t lod) const {
+    Value fr = zero();
+    if (m_data->isotropic_tables)
+        sample_impl(m_data->level_iso(lod), u, wi, wo_out, pdf_out, fr);
+    else
+        sample_impl(m_data->level(lod), u, wi, wo_out, pdf_out, fr);
+    return fr;
+}
+
+template <size_t Channels>
+float BasicBRDF<Channels>::sample_luminance(const Vector2f &u, const Vector3f &wi,
+                                            Vector3f *wo_out, float *pdf_out,
+                                            uint32_t lod) const {
+    float fr;
+    if (m_data->isotropic_tables)
+        sample_impl(m_data->level_iso(lod), u, wi, wo_out, pdf_out, fr);
+    else
+        sample_impl(m_data->level(lod), u, wi, wo_out, pdf_out, fr);
+    return fr;
+}
+
+// *****************************************************************************
+// Prefetching
+// *****************************************************************************
+
+template <size_t Channels> template <typename Tables>
+void BasicBRDF<Channels>::prefetch_impl(const Tables &level, const Vector3f &wi) const {
+    if (wi.z() <= 0)
+        return;
+
+    const Data &d = *m_data;
+    float params[3] = { azimuth(wi), elevation(wi), 0.f };
+    level.vndf.prefetch(params + Tables::FirstParam);
+    level.luminance.prefetch(params + Tables::FirstParam);
+
+    if (d.color_paged)
+        return;
+
+    /* All channels (or basis coefficients) at once, which shares the slices
+       of neighboring channels */
+    size_t count = d.basis_size > 0 ? d.basis_size : d.channel_count();
+    level.color.prefetch(params + Tables::FirstParam, (uint32_t) count);
+}
+
+template <size_t Channels>
+void BasicBRDF<Channels>::prefetch(const Vector3f &wi, uint32_t lod) const {
+    if (m_data->isotropic_tables)
+        prefetch_impl(m_data->level_iso(lod), wi);
+    else
+        prefetch_impl(m_data->level(lod), wi);
+}
+
+template <size_t Channels>
+void BasicBRDF<Channels>::prefetch(size_t count, const Vector3f *wi,
+                                   uint32_t lod) const {
+    if (m_data->isotropic_tables) {
+        const auto &level = m_data->level_iso(lod);
+        for (size_t i = 0; i < count; ++i)
+            prefetch_impl(level, wi[i]);
+    } else {
+        const auto &level = m_data->level(lod);
+        for (size_t i = 0; i < count; ++i)
+            prefetch_impl(level, wi[i]);
+    }
+}
+
+// *****************************************************************************
+// Bulk queries
+// *****************************************************************************
+
+/// Number of queries per chunk that keeps the outputs of different chunks on separate cache lines
+inline size_t bulk_chunk_size(const BulkOptions &options) {
+    return (std::max(options.chunk_size, (size_t) 1) + 15) / 16 * 16;
+}
+
+/// Return the index of the interval of the ascending sequence \c values that contains \c value
+inline uint32_t grid_cell(const FloatStorage &values, float value) {
+    if (values.size() < 2)
+        return 0;
+    return (uint32_t) find_interval(
+        values.size(),
+        [&](uint32_t idx) {
+            return values[idx] <= value;
+        });
+}
+
+/// Number of queries whose warps \c sample_bulk() processes together
+static constexpr size_t BulkSampleBlock = 64;
+
+/**
+ * Invoke \c func(begin, end, order) for chunks of the \c count queries on the
+ * workers of \c parallel_chunks(), where position \c j of a chunk refers to
+ * query <tt>order[j]</tt>, or to query \c j if \c order is \c nullptr. If
+ * \c options.sort is set, the queries are visited in the order of the cell of
+ * the incident direction grid (\c phi_values, \c theta_values) containing
+ * \c wi[i]. The azimuth is ignored by \c isotropic tables.
+ */
+template <typename Func>
+void bulk_queries(size_t count, const Vector3f *wi, const FloatStorage &phi_values,
+                  const FloatStorage &theta_values, bool isotropic,
+                  const BulkOptions &options, const Func &func) {
+    size_t chunk_size = bulk_chunk_size(options);
+    if (!options.sort) {
+        parallel_chunks(count, chunk_size, options.threads,
+                        [&](size_t begin, size_t end) {
+            func(begin, end, (const size_t *) nullptr);
+        });
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint32_t n_phi   = isotropic ? 1 : (uint32_t) std::max(phi_values.size(), (size_t) 1),
+             n_theta = (uint32_t) std::max(theta_values.size(), (size_t) 1),
+             n_cells = n_phi * n_theta;
+
+    /* Compute the cell of each query (n_cells: below the horizon) */
+    std::vector<uint32_t> cell(count);
+    parallel_chunks(count, chunk_size, options.threads,
+                    [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            if (wi[i].z() <= 0) {
+                cell[i] = n_cells;
+                continue;
+            }
+            uint32_t i_theta = grid_cell(theta_values, elevation(wi[i])),
+                     i_phi   = isotropic ? 0 : grid_cell(phi_values, azimuth(wi[i]));
+            cell[i] = i_theta * n_phi + i_phi;
+        }
+    });
+
+    /* Counting sort of the query indices by cell */
+    std::vector<size_t> offset(n_cells + 2, 0), order(count);
+    for (size_t i = 0; i < count; ++i)
+        offset[cell[i] + 1]++;
+    for (uint32_t i = 1; i < n_cells + 2; ++i)
+        offset[i] += offset[i - 1];
+    for (size_t i = 0; i < count; ++i)
+        order[offset[cell[i]]++] = i;
+
+    if (options.sort_seconds)
+        *options.sort_seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+    parallel_chunks(count, chunk_size, options.threads,
+                    [&](size_t begin, size_t end) {
+        func(begin, end, order.data());
+    });
+}
+
+/**
+ * Evaluate \c sample() for the \c count (at most \c BulkSampleBlock) queries
+ * <tt>index[k]</tt>. The luminance and VNDF warps of all queries are sampled
+ * by \c Marginal2D::sample_interleaved(), which overlaps their dependent
+ * loads, before the remainder of each query is evaluated.
+ */
+template <size_t Channels> template <typename Tables>
+void BasicBRDF<Channels>::sample_block(const Tables &level, size_t count,
+                                       const size_t *index, const Vector2f *u,
+                                       const Vector3f *wi, Vector3f *wo,
+                                       float *pdf, float *out) const {
+    const size_t channels = m_data->channel_count();
+    size_t active[BulkSampleBlock];
+    float params[2 * BulkSampleBlock], lum_pdf[BulkSampleBlock],
+          ndf_pdf[BulkSampleBlock];
+    Vector2f sample[BulkSampleBlock], u_wm[BulkSampleBlock];
+
+    size_t n = 0;
+    for (size_t k = 0; k < count; ++k) {
+        size_t i = index[k];
+        if (wi[i].z() <= 0) {
+            if (wo)
+                wo[i] = Vector3f(0.f);
+            if (pdf)
+                pdf[i] = 0;
+            ChannelSpan fr { out + i * channels, channels };
+            set_zero(fr, channels);
+            continue;
+        }
+
+        params[2 * n]     = azimuth(wi[i]);
+        params[2 * n + 1] = elevation(wi[i]);
+        sample[n] = Vector2f(u[i].y(), u[i].x());
+        lum_pdf[n] = 1.f;
+        active[n++] = i;
+    }
+
+    #if POWITACQ_SAMPLE_LUMINANCE
+        level.luminance.sample_interleaved(n, sample, lum_pdf,
+                                           params + Tables::FirstParam, 2);
+    #endif
+
+    std::copy(sample, sample + n, u_wm);
+    level.vndf.sample_interleaved(n, u_wm, ndf_pdf, params + Tables::FirstParam, 2);
+
+    for (size_t k = 0; k < n; ++k) {
+        size_t i = active[k];
+        ChannelSpan fr { out + i * channels, channels };
+        sample_finish(level, wi[i], params[2 * k], params[2 * k + 1], sample[k],
+                      lum_pdf[k], u_wm[k], ndf_pdf[k], wo ? wo + i : nullptr,
+                      pdf ? pdf + i : nullptr, fr);
+    }
+}
+
+template <size_t Channels>
+void BasicBRDF<Channels>::eval_bulk(size_t count, const Vector3f *wi, const Vector3f *wo,
+                                    float *out, const BulkOptions &options,
+                                    uint32_t lod) const {
+    const Data &d = *m_data;
+    const size_t channels = d.channel_count();
+    bulk_queries(count, wi, d.phi_i, d.theta_i, d.isotropic_tables, options,
+                 [&](size_t begin, size_t end, const size_t *order) {
+        for (size_t j = begin; j < end; ++j) {
+            size_t i = order ? order[j] : j;
+            ChannelSpan fr { out + i * channels, channels };
+            if (d.isotropic_tables)
+                eval_impl(d.level_iso(lod), wi[i], wo[i], fr);
+            else
+                eval_impl(d.level(lod), wi[i], wo[i], fr);
+        }
+    });
+}
+
+template <size_t Channels>
+void BasicBRDF<Channels>::sample_bulk(size_t count, const Vector2f *u, const Vector3f *wi,
+                                      Vector3f *wo, float *pdf, float *out,
+                                      const BulkOptions &options, uint32_t lod) const {
+    const Data &d = *m_data;
+    bulk_queries(count, wi, d.phi_i, d.theta_i, d.isotropic_tables, options,
+                 [&](size_t begin, size_t end, const size_t *order) {
+        if (!options.interleave) {
+            const size_t channels = d.channel_count();
+            for (size_t j = begin; j < end; ++j) {
+                size_t i = order ? order[j] : j;
+                ChannelSpan fr { out + i * channels, channels };
+                Vector3f *wo_i = wo ? wo + i : nullptr;
+                float *pdf_i = pdf ? pdf + i : nullptr;
+                if (d.isotropic_tables)
+                    sample_impl(d.level_iso(lod), u[i], wi[i], wo_i, pdf_i, fr);
+                else
+                    sample_impl(d.level(lod), u[i], wi[i], wo_i, pdf_i, fr);
+            }
+            return;
+        }
+
+        size_t index[BulkSampleBlock];
+        for (size_t j = begin; j < end; j += BulkSampleBlock) {
+            size_t n = std::min(end - j, BulkSampleBlock);
+            for (size_t k = 0; k < n; ++k)
+                index[k] = order ? order[j + k] : j + k;
+
+            if (d.isotropic_tables)
+                sample_block(d.level_iso(lod), n, index, u, wi, wo, pdf, out);
+            else
+                sample_block(d.level(lod), n, index, u, wi, wo, pdf, out);
+        }
+    });
+}
+
+template <size_t Channels>
+void BasicBRDF<Channels>::pdf_bulk(size_t count, const Vector3f *wi, const Vector3f *wo,
+                                   float *pdf_out, const BulkOptions &options,
+                                   uint32_t lod) const {
+    const Data &d = *m_data;
+    bulk_queries(count, wi, d.phi_i, d.theta_i, d.isotropic_tables, options,
+                 [&](size_t begin, size_t end, const size_t *order) {
+        for (size_t j = begin; j < end; ++j) {
+            size_t i = order ? order[j] : j;
+            pdf_out[i] = pdf(wi[i], wo[i], lod);
+        }
+    });
+}
+
+// *****************************************************************************
+// Bound incident direction
+// *****************************************************************************
+
+template <size_t Channels> struct BasicBoundBRDF<Channels>::Data {
+    /// Material (keeps the tables referenced below alive)
+    std::shared_ptr<const typename BasicBRDF<Channels>::Data> brdf;
+
+    /// NDF of the bound level of detail
+    const Warp2D0 *ndf;
+
+    Vector3f wi;
+    float phi_i;
+
+    /// Projected area of the microfacets in direction wi (times four)
+    float sigma4;
+
+    /// Slices of the VNDF and luminance tables at (phi_i, theta_i)
+    Warp2D0 vndf, luminance;
+
+    /// Slices of the color table for each channel (or basis coefficient)
+    std::vector<Warp2D0> color;
+
+    /// Slices of the out-of-core color table (if applicable)
+    PagedWarp2D3::Slices paged;
+
+    Data(const std::shared_ptr<const typename BasicBRDF<Channels>::Data> &brdf,
+         const Warp2D0 *ndf, const Vector3f &wi, float phi_i = 0.f,
+         float sigma4 = 0.f, Warp2D0 &&vndf = Warp2D0(),
+         Warp2D0 &&luminance = Warp2D0())
+        : brdf(brdf), ndf(ndf), wi(wi), phi_i(phi_i), sigma4(sigma4),
+          vndf(std::move(vndf)), luminance(std::move(luminance)) { }
+
+    /// Interpolate the color at position \c sample (see \ref BasicBRDF::color())
+    Value color_at(const Vector2f &sample) const {
+        const auto &d = *brdf;
+        const size_t channels = d.channel_count();
+
+        Value fr = zero_color<Channels>(channels);
+        if (d.basis_size > 0) {
+            /* Reconstruct the spectrum from the basis coefficients */
+            float coeffs[MaxSpectralBasisSize];
+            for (uint32_t k = 0; k < d.basis_size; ++k)
+                coeffs[k] = color[k].eval(sample);
+
+            const float *basis = d.basis.data();
+            for (size_t i = 0; i < channels; ++i) {
+                float value = 0.f;
+                for (uint32_t k = 0; k < d.basis_size; ++k)
+                    value += basis[k] * coeffs[k];
+                fr[i] = value;
+                basis += d.basis_size;
+            }
+        } else if (d.color_paged) {
+            for (size_t i = 0; i < channels; ++i) {
+                float param = float(i);
+                fr[i] = paged.eval(sample, &param);
+            }
+        } else {
+            for (size_t i = 0; i < channels; ++i)
+                fr[i] = color[i].eval(sample);
+        }
+
+        #if POWITACQ_CLIP_RGB
+            if (Channels != Dynamic) {
+                for (size_t i = 0; i < channels; ++i)
+                    fr[i] = std::max(0.f, fr[i]);
+            }
+        #endif
+
+        return fr;
+    }
+};
+
+template <size_t Channels> template <typename Tables>
+BasicBoundBRDF<Channels> BasicBRDF<Channels>::bind_impl(const Tables &level,
+                                                        const Vector3f &wi) const {
+    using Bound = BasicBoundBRDF<Channels>;
+    const Data &d = *m_data;
+    if (wi.z() <= 0)
+        return Bound(std::make_shared<typename Bound::Data>(m_data, &level.ndf, wi));
+
+    float theta_i = elevation(wi),
+          phi_i   = azimuth(wi);
+
+    float params[3] = { phi_i, theta_i, 0.f };
+    Vector2f u_wi = Vector2f(theta2u(theta_i), phi2u(phi_i));
+
+    /* Interpolate the slices associated with (phi_i, theta_i) */
+    std::shared_ptr<typename Bound::Data> b = std::make_shared<typename Bound::Data>(
+        m_data, &level.ndf, wi, phi_i, 4 * level.sigma.eval(u_wi, params),
+        level.vndf.slice(params + Tables::FirstParam),
+        level.luminance.slice(params + Tables::FirstParam));
+
+    if (d.color_paged) {
+        b->paged = d.color_paged->slices(params);
+    } else {
+        size_t count = d.basis_size > 0 ? d.basis_size : d.channel_count();
+        b->color.reserve(count);
+        for (size_t k = 0; k < count; ++k) {
+            params[2] = float(k);
+            b->color.push_back(level.color.slice(params + Tables::FirstParam));
+        }
+    }
+
+    return Bound(b);
+}
+
+template <size_t Channels>
+BasicBoundBRDF<Channels> BasicBRDF<Channels>::bind(const Vector3f &wi, uint32_t lod) const {
+    if (m_data->isotropic_tables)
+        return bind_impl(m_data->level_iso(lod), wi);
+    else
+        return bind_impl(m_data->level(lod), wi);
+}
+
+template <size_t Channels>
+BasicBoundBRDF<Channels>::BasicBoundBRDF(const std::shared_ptr<const Data> &data)
+    : m_data(data) { }
+
+template <size_t Channels> const Vector3f &BasicBoundBRDF<Channels>::wi() const {
+    return m_data->wi;
+}
+
+template <size_t Channels>
+Color<Channels> BasicBoundBRDF<Channels>::eval(const Vector3f &wo) const {
+    const Data &b = *m_data;
+    if (b.wi.z() <= 0 || wo.z() <= 0)
+        return zero_color<Channels>(b.brdf->channel_count());
+
+    Vector3f wm = normalize(b.wi + wo);
+
+    /* Cartesian -> spherical coordinates */
+    float theta_m = elevation(wm),
+          phi_m   = azimuth(wm);
+
+    /* Spherical coordinates -> unit coordinate system */
+    Vector2f u_wm = Vector2f(
+        theta2u(theta_m),
+        phi2u(b.brdf->isotropic ? (phi_m - b.phi_i) : phi_m)
+    );
+    u_wm.y() = u_wm.y() - std::floor(u_wm.y());
+
+    Vector2f sample;
+    float vndf_pdf;
+    std::tie(sample, vndf_pdf) = b.vndf.invert(u_wm);
+
+    Value fr = b.color_at(sample);
+    fr *= b.ndf->eval(u_wm) / b.sigma4;
+
+    return fr;
+}
+
+template <size_t Channels>
+float BasicBoundBRDF<Channels>::pdf(const Vector3f &wo) const {
+    const Data &b = *m_data;
+    if (b.wi.z() <= 0 || wo.z() <= 0)
+        return 0;
+
+    Vector3f wm = normalize(b.wi + wo);
+
+    /* Cartesian -> spherical coordinates */
+    float theta_m = elevation(wm),
+          phi_m   = azimuth(wm);
+
+    /* Spherical coordinates -> unit coordinate system */
+    Vector2f u_wm = Vector2f(
+        theta2u(theta_m),
+        phi2u(b.brdf->isotropic ? (phi_m - b.phi_i) : phi_m)
+    );
+    u_wm.y() = u_wm.y() - std::floor(u_wm.y());
+
+    Vector2f sample;
+    float vndf_pdf;
+    std::tie(sample, vndf_pdf) = b.vndf.invert(u_wm);
+
+    float pdf = 1.f;
+    #if POWITACQ_SAMPLE_LUMINANCE
+        pdf = b.luminance.eval(sample);
+    #endif
+
+    float sin_theta_m = std::sqrt(sqr(wm.x()) + sqr(wm.y()));
+    float jacobian = std::max(2.f * sqr(Pi) * u_wm.x() *
+                              sin_theta_m, 1e-6f) * 4.f * dot(b.wi, wm);
+
+    return vndf_pdf * pdf / jacobian;
+}
+
+template <size_t Channels>
+Color<Channels> BasicBoundBRDF<Channels>::sample(const Vector2f &u, Vector3f *wo_out,
+                                                 float *pdf_out) const {
+    const Data &b = *m_data;
+    if (b.wi.z() <= 0) {
+        if (wo_out)
+            *wo_out = Vector3f(0.f);
+        if (pdf_out)
+            *pdf_out = 0;
+        return zero_color<Channels>(b.brdf->channel_count());
+    }
+
+    Vector2f sample = Vector2f(u.y(), u.x());
+    float lum_pdf = 1.f;
 
     #if POWITACQ_SAMPLE_LUMINANCE
-        std::tie(sample, lum_pdf) =
-            m_data->luminance.sample(sample, params);
+        std::tie(sample, lum_pdf) = b.luminance.sample(sample);
     #endif
 
     Vector2f u_wm;
     float ndf_pdf;
-    std::tie(u_wm, ndf_pdf) =
-        m_data->vndf.sample(sample, params);
+    std::tie(u_wm, ndf_pdf) = b.vndf.sample(sample);
 
     float phi_m   = u2phi(u_wm.y()),
           theta_m = u2theta(u_wm.x());
 
-    if (m_data->isotropic)
-        phi_m += phi_i;
+    if (b.brdf->isotropic)
+        phi_m += b.phi_i;
 
     /* Spherical -> Cartesian coordinates */
-    float sin_phi_m = std::sin(phi_m),
-          cos_phi_m = std::cos(phi_m),
-          sin_theta_m = std::sin(theta_m),
-          cos_theta_m = std::cos(theta_m);
+    float sin_phi_m, cos_phi_m, sin_theta_m, cos_theta_m;
+    sincos(phi_m, sin_phi_m, cos_phi_m);
+    sincos(theta_m, sin_theta_m, cos_theta_m);
 
     Vector3f wm = Vector3f(
         cos_phi_m * sin_theta_m,
@@ -1151,27 +4619,20 @@ Spectrum BRDF::sample(const Vector2f &u, const Vector3f &wi,
         cos_theta_m
     );
 
-    Vector3f wo = wm * 2.f * dot(wm, wi) - wi;
+    Vector3f wo = wm * 2.f * dot(wm, b.wi) - b.wi;
     if (wo.z() <= 0) {
         if (wo_out)
             *wo_out = Vector3f(0.f);
         if (pdf_out)
             *pdf_out = 0;
-        return zero();
+        return zero_color<Channels>(b.brdf->channel_count());
     }
 
-    Spectrum fr = zero();
-    for (int i = 0; i < (int) m_data->wavelengths.size(); ++i) {
-        float params_fr[3] = { phi_i, theta_i, m_data->wavelengths[i] };
-
-        fr[i] = m_data->spectra.eval(sample, params_fr);
-    }
-
-    fr *= m_data->ndf.eval(u_wm, params) /
-            (4 * m_data->sigma.eval(u_wi, params));
+    Value fr = b.color_at(sample);
+    fr *= b.ndf->eval(u_wm) / b.sigma4;
 
     float jacobian = std::max(2.f * sqr(Pi) * u_wm.x() *
-                              sin_theta_m, 1e-6f) * 4.f * dot(wi, wm);
+                              sin_theta_m, 1e-6f) * 4.f * dot(b.wi, wm);
 
     float pdf = ndf_pdf * lum_pdf / jacobian;
 
@@ -1181,4 +4642,879 @@ Spectrum BRDF::sample(const Vector2f &u, const Vector3f &wi,
     return fr / pdf;
 }
 
+// *****************************************************************************
+// Hot reloading
+// *****************************************************************************
+
+/**
+ * Process-wide epoch-based reclamation. Threads announce the global epoch in
+ * a private slot while they access shared data (see \c EpochGuard), and data
+ * that was unlinked before the epoch was advanced past \c e may be released
+ * once no slot holds an epoch <= \c e.
+ */
+class EpochDomain {
+public:
+    /// Epoch of a slot whose thread is not accessing shared data
+    static constexpr uint64_t Idle = std::numeric_limits<uint64_t>::max();
+
+    struct alignas(Alignment) Slot {
+        std::atomic<uint64_t> epoch;
+        std::atomic<bool> used;
+        Slot *next;
+    };
+
+    static EpochDomain &instance() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    /// Return the slot of the calling thread (registered upon the first call)
+    Slot *thread_slot() {
+        struct Owner {
+            Slot *slot = nullptr;
+            ~Owner() {
+                if (slot)
+                    slot->used.store(false, std::memory_order_release);
+            }
+        };
+        static thread_local Owner owner;
+        if (!owner.slot)
+            owner.slot = acquire_slot();
+        return owner.slot;
+    }
+
+    /// Return the current epoch
+    uint64_t epoch() const { return m_epoch.load(std::memory_order_seq_cst); }
+
+    /// Advance the epoch and return its previous value
+    uint64_t advance() { return m_epoch.fetch_add(1, std::memory_order_seq_cst); }
+
+    /// Has every thread left the accesses that started at an epoch <= \c epoch?
+    bool quiescent(uint64_t epoch) const {
+        for (Slot *slot = m_head.load(std::memory_order_acquire); slot; slot = slot->next) {
+            if (slot->epoch.load(std::memory_order_seq_cst) <= epoch)
+                return false;
+        }
+        return true;
+    }
+
+private:
+    EpochDomain() : m_epoch(0), m_head(nullptr) { }
+
+    /**
+     * Reuse the slot of a thread that has exited, or append a new one. Slots
+     * are never released, since detached threads may outlive the domain.
+     */
+    Slot *acquire_slot() {
+        for (Slot *slot = m_head.load(std::memory_order_acquire); slot; slot = slot->next) {
+            bool expected = false;
+            if (!slot->used.load(std::memory_order_relaxed) &&
+                slot->used.compare_exchange_strong(expected, true))
+                return slot;
+        }
+
+        Slot *slot = new (aligned_malloc(sizeof(Slot))) Slot();
+        slot->epoch.store(Idle, std::memory_order_relaxed);
+        slot->used.store(true, std::memory_order_relaxed);
+        slot->next = m_head.load(std::memory_order_relaxed);
+        while (!m_head.compare_exchange_weak(slot->next, slot, std::memory_order_release,
+                                             std::memory_order_relaxed))
+            ;
+        return slot;
+    }
+
+    std::atomic<uint64_t> m_epoch;
+    std::atomic<Slot *> m_head;
+};
+
+constexpr uint64_t EpochDomain::Idle;
+
+/// Announces the current epoch in the slot of the calling thread during its lifetime
+class EpochGuard {
+public:
+    EpochGuard() : m_slot(EpochDomain::instance().thread_slot()) {
+        /* Nested guards keep the epoch of the outermost one */
+        m_outer = m_slot->epoch.load(std::memory_order_relaxed) == EpochDomain::Idle;
+        if (m_outer) {
+            m_slot->epoch.store(EpochDomain::instance().epoch(), std::memory_order_relaxed);
+            /* Order the announcement before the following loads of shared pointers */
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    ~EpochGuard() {
+        if (m_outer)
+            m_slot->epoch.store(EpochDomain::Idle, std::memory_order_release);
+    }
+
+    EpochGuard(const EpochGuard &) = delete;
+    EpochGuard &operator=(const EpochGuard &) = delete;
+
+private:
+    EpochDomain::Slot *m_slot;
+    bool m_outer;
+};
+
+template <size_t Channels> struct BasicReloadableBRDF<Channels>::Data {
+    using BRDF = BasicBRDF<Channels>;
+
+    /// Material used by queries
+    std::atomic<const BRDF *> current;
+
+    /// Serializes \c store() and \c collect()
+    std::mutex mutex;
+
+    /// Replaced materials, along with the epoch at which they were unlinked
+    std::vector<std::pair<uint64_t, std::unique_ptr<const BRDF>>> retired;
+
+    /// Release retired materials that are no longer in use (needs 'mutex')
+    size_t collect() {
+        const EpochDomain &domain = EpochDomain::instance();
+        retired.erase(
+            std::remove_if(retired.begin(), retired.end(),
+                           [&](const std::pair<uint64_t, std::unique_ptr<const BRDF>> &entry) {
+                               return domain.quiescent(entry.first);
+                           }),
+            retired.end());
+        return retired.size();
+    }
+};
+
+template <size_t Channels>
+BasicReloadableBRDF<Channels>::BasicReloadableBRDF(const BasicBRDF<Channels> &brdf)
+    : m_data(new Data()) {
+    m_data->current.store(new BasicBRDF<Channels>(brdf), std::memory_order_release);
+}
+
+template <size_t Channels> BasicReloadableBRDF<Channels>::~BasicReloadableBRDF() {
+    delete m_data->current.load(std::memory_order_acquire);
+}
+
+template <size_t Channels>
+void BasicReloadableBRDF<Channels>::store(const BasicBRDF<Channels> &brdf) {
+    Data &d = *m_data;
+    std::unique_ptr<const BasicBRDF<Channels>> next(new BasicBRDF<Channels>(brdf));
+
+    std::lock_guard<std::mutex> guard(d.mutex);
+    const BasicBRDF<Channels> *prev =
+        d.current.exchange(next.release(), std::memory_order_seq_cst);
+
+    /* Queries that can still see 'prev' announced an epoch <= the current one */
+    d.retired.emplace_back(EpochDomain::instance().advance(),
+                           std::unique_ptr<const BasicBRDF<Channels>>(prev));
+    d.collect();
+}
+
+template <size_t Channels>
+void BasicReloadableBRDF<Channels>::reload(const std::string &path_to_file,
+                                           const LoadOptions &options) {
+    store(BasicBRDF<Channels>(path_to_file, options));
+}
+
+template <size_t Channels> size_t BasicReloadableBRDF<Channels>::collect() {
+    std::lock_guard<std::mutex> guard(m_data->mutex);
+    return m_data->collect();
+}
+
+template <size_t Channels>
+BasicBRDF<Channels> BasicReloadableBRDF<Channels>::load() const {
+    EpochGuard guard;
+    return *m_data->current.load(std::memory_order_acquire);
+}
+
+template <size_t Channels>
+Color<Channels> BasicReloadableBRDF<Channels>::eval(const Vector3f &wi, const Vector3f &wo,
+                                                    uint32_t lod) const {
+    EpochGuard guard;
+    return m_data->current.load(std::memory_order_acquire)->eval(wi, wo, lod);
+}
+
+template <size_t Channels>
+Color<Channels> BasicReloadableBRDF<Channels>::sample(const Vector2f &u, const Vector3f &wi,
+                                                      Vector3f *wo, float *pdf,
+                                                      uint32_t lod) const {
+    EpochGuard guard;
+    return m_data->current.load(std::memory_order_acquire)->sample(u, wi, wo, pdf, lod);
+}
+
+template <size_t Channels>
+float BasicReloadableBRDF<Channels>::pdf(const Vector3f &wi, const Vector3f &wo,
+                                         uint32_t lod) const {
+    EpochGuard guard;
+    return m_data->current.load(std::memory_order_acquire)->pdf(wi, wo, lod);
+}
+
+// *****************************************************************************
+// Directional albedo
+// *****************************************************************************
+
+/**
+ * Locate \c value within the ascending sequence \c values and return the
+ * index of the enclosing interval along with the interpolation weight of its
+ * right endpoint (clamped to the domain).
+ */
+static uint32_t find_weight(const FloatStorage &values, float value, float &weight) {
+    if (values.size() < 2) {
+        weight = 0.f;
+        return 0;
+    }
+
+    uint32_t index = (uint32_t) find_interval(
+        values.size(),
+        [&](uint32_t idx) {
+            return values[idx] <= value;
+        });
+
+    weight = clamp((value - values[index]) / (values[index + 1] - values[index]),
+                   0.f, 1.f);
+    return index;
+}
+
+template <size_t Channels>
+Color<Channels> BasicBRDF<Channels>::albedo(const Vector3f &wi) const {
+    Data &d = *m_data;
+    const size_t channels = d.channel_count();
+    uint32_t n_phi   = (uint32_t) d.phi_i.size(),
+             n_theta = (uint32_t) d.theta_i.size();
+
+    /* Integrate f_r * cos at the tabulated incident directions (once) */
+    std::call_once(d.albedo_once, [&]() {
+        const uint32_t res = 64;
+        d.albedo = FloatStorage((size_t) n_phi * n_theta * channels,
+                                AlignedAllocator<float>(d.arena.get()));
+
+        parallel_for(n_phi * n_theta, [&](size_t index) {
+            float phi   = d.phi_i[index / n_theta],
+                  theta = d.theta_i[index % n_theta];
+
+            Vector3f wi_grid = Vector3f(std::cos(phi) * std::sin(theta),
+                                        std::sin(phi) * std::sin(theta),
+                                        std::cos(theta));
+
+            /* Stratified estimate based on importance sampling */
+            std::vector<double> sum(channels, 0.0);
+            for (uint32_t i = 0; i < res * res; ++i) {
+                Vector2f u = Vector2f((i % res + .5f) / res, (i / res + .5f) / res);
+                Value weight = sample(u, wi_grid);
+                for (size_t ch = 0; ch < channels; ++ch) {
+                    if (std::isfinite(weight[ch]))
+                        sum[ch] += weight[ch];
+                }
+            }
+
+            for (size_t ch = 0; ch < channels; ++ch)
+                d.albedo[index * channels + ch] = float(sum[ch] / (res * res));
+        });
+    });
+
+    if (wi.z() <= 0)
+        return zero();
+
+    float w_phi, w_theta;
+    uint32_t i_phi   = find_weight(d.phi_i, azimuth(wi), w_phi),
+             i_theta = find_weight(d.theta_i, elevation(wi), w_theta);
+
+    Value result = zero();
+    for (uint32_t i = 0; i < 2; ++i) {
+        for (uint32_t j = 0; j < 2; ++j) {
+            float w = (i ? w_phi : 1.f - w_phi) * (j ? w_theta : 1.f - w_theta);
+            if (w == 0.f)
+                continue;
+
+            const float *value = d.albedo.data() +
+                ((size_t) (i_phi + i) * n_theta + i_theta + j) * channels;
+            for (size_t ch = 0; ch < channels; ++ch)
+                result[ch] += w * value[ch];
+        }
+    }
+
+    return result;
+}
+
+// *****************************************************************************
+// Analytic proxy
+// *****************************************************************************
+
+/// Anisotropic GGX microfacet distribution
+inline float ggx_ndf(const Vector3f &m, float alpha_u, float alpha_v) {
+    if (m.z() <= 0)
+        return 0.f;
+    float d = sqr(m.x() / alpha_u) + sqr(m.y() / alpha_v) + sqr(m.z());
+    return 1.f / (Pi * alpha_u * alpha_v * sqr(d));
+}
+
+/// Smith shadowing-masking term of the anisotropic GGX distribution
+inline float ggx_g1(const Vector3f &v, const Vector3f &m, float alpha_u, float alpha_v) {
+    if (dot(v, m) <= 0 || v.z() <= 0)
+        return 0.f;
+    float tan2 = (sqr(alpha_u * v.x()) + sqr(alpha_v * v.y())) / sqr(v.z());
+    return 2.f / (1.f + std::sqrt(1.f + tan2));
+}
+
+/// Cosine-weighted specular lobe with unit scale factor
+inline float proxy_specular(const Vector3f &wi, const Vector3f &wo,
+                            float alpha_u, float alpha_v) {
+    Vector3f wm = normalize(wi + wo);
+    return ggx_ndf(wm, alpha_u, alpha_v) * ggx_g1(wi, wm, alpha_u, alpha_v) *
+           ggx_g1(wo, wm, alpha_u, alpha_v) / (4.f * wi.z());
+}
+
+template <size_t Channels>
+Color<Channels> BasicProxy<Channels>::eval(const Vector3f &wi, const Vector3f &wo) const {
+    if (wi.z() <= 0 || wo.z() <= 0)
+        return diffuse * 0.f;
+
+    return diffuse * (wo.z() / Pi) +
+           specular * proxy_specular(wi, wo, alpha_u, alpha_v);
+}
+
+template <size_t Channels>
+const BasicProxy<Channels> &BasicBRDF<Channels>::proxy() const {
+    Data &d = *m_data;
+
+    std::call_once(d.proxy_once, [&]() {
+        /* 1. Roughness. The GGX distribution satisfies
+              (pi * cos^4 theta * D)^(-1/2) = c0 + tan^2 theta * (c1 * cos^2 phi + c2 * sin^2 phi)
+              with c0 = sqrt(a_u a_v), c1 = c0 / a_u^2 and c2 = c0 / a_v^2. Fit
+              the coefficients by least squares over the NDF table, weighting
+              each entry by its share of the projected microfacet area. The
+              ratios c0/c1 and c0/c2 do not depend on the normalization of D. */
+        const uint32_t res = 128;
+        double A[3][3] = { }, b[3] = { };
+        for (uint32_t i = 0; i < res * res; ++i) {
+            Vector2f u_wm = Vector2f((i % res + .5f) / res, (i / res + .5f) / res);
+            float theta_m = u2theta(u_wm.x()), phi_m = u2phi(u_wm.y()),
+                  value = (d.isotropic_tables ? d.levels_iso[0].ndf
+                                              : d.levels[0].ndf).eval(u_wm);
+            if (!(value > 0) || theta_m > 1.4f)
+                continue;
+
+            float cos_theta_m = std::cos(theta_m),
+                  tan2 = sqr(std::tan(theta_m)),
+                  weight = value * cos_theta_m * std::sin(theta_m) * u_wm.x(),
+                  x[3] = { 1.f, tan2 * sqr(std::cos(phi_m)), tan2 * sqr(std::sin(phi_m)) },
+                  y = 1.f / std::sqrt(Pi * sqr(sqr(cos_theta_m)) * value);
+            for (int j = 0; j < 3; ++j) {
+                for (int k = 0; k < 3; ++k)
+                    A[j][k] += weight * x[j] * x[k];
+                b[j] += weight * x[j] * y;
+            }
+        }
+
+        /* Solve the normal equations (Cramer's rule) */
+        auto det3 = [](const double m[3][3]) {
+            return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                   m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                   m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        };
+        double det = det3(A), coeffs[3] = { };
+        for (int j = 0; j < 3 && det != 0; ++j) {
+            double M[3][3];
+            for (int r = 0; r < 3; ++r)
+                for (int c = 0; c < 3; ++c)
+                    M[r][c] = c == j ? b[r] : A[r][c];
+            coeffs[j] = det3(M) / det;
+        }
+
+        float alpha_u = (float) std::sqrt(coeffs[0] / coeffs[1]),
+              alpha_v = (float) std::sqrt(coeffs[0] / coeffs[2]);
+        if (!std::isfinite(alpha_u) || !std::isfinite(alpha_v))
+            alpha_u = alpha_v = 1.f;
+        d.proxy.alpha_u = clamp(alpha_u, 1e-3f, 1.f);
+        d.proxy.alpha_v = clamp(alpha_v, 1e-3f, 1.f);
+
+        /* 2. Lobe weights. Fit the diffuse and specular scale factors to
+              f_r * cos via least squares over random pairs of directions,
+              half of which are importance sampled from the full model. The
+              sums are laid out as [x0 x0, x0 x1, x1 x1, x0 f_r (per channel),
+              x1 f_r (per channel)]. */
+        const size_t channels = d.channel_count();
+        const uint32_t samples = 65536, block_size = 1024,
+                       blocks = samples / block_size;
+        std::vector<std::vector<double>> sums(blocks);
+
+        parallel_for(blocks, [&](size_t block) {
+            std::mt19937 rng((uint32_t) block);
+            std::uniform_real_distribution<float> dist;
+            std::vector<double> &s = sums[block];
+            s.assign(3 + 2 * channels, 0.0);
+
+            for (uint32_t i = 0; i < block_size; ++i) {
+                /* Cosine-weighted incident direction */
+                float r = std::sqrt(dist(rng)), phi = 2.f * Pi * dist(rng);
+                Vector3f wi = Vector3f(r * std::cos(phi), r * std::sin(phi),
+                                       std::sqrt(std::max(0.f, 1.f - sqr(r))));
+
+                Vector3f wo;
+                Vector2f u = Vector2f(dist(rng), dist(rng));
+                if (i % 2 == 0) {
+                    sample(u, wi, &wo);
+                } else {
+                    float z = u.x(), r_o = std::sqrt(std::max(0.f, 1.f - sqr(z)));
+                    wo = Vector3f(r_o * std::cos(2.f * Pi * u.y()),
+                                  r_o * std::sin(2.f * Pi * u.y()), z);
+                }
+                if (wi.z() <= 0 || wo.z() <= 0)
+                    continue;
+
+                Value value = eval(wi, wo);
+                float x0 = wo.z() / Pi,
+                      x1 = proxy_specular(wi, wo, d.proxy.alpha_u, d.proxy.alpha_v);
+                bool valid = std::isfinite(x1);
+                for (size_t ch = 0; ch < channels; ++ch)
+                    valid &= std::isfinite(value[ch]);
+                if (!valid)
+                    continue;
+
+                s[0] += x0 * x0; s[1] += x0 * x1; s[2] += x1 * x1;
+                for (size_t ch = 0; ch < channels; ++ch) {
+                    s[3 + ch] += x0 * value[ch];
+                    s[3 + channels + ch] += x1 * value[ch];
+                }
+            }
+        });
+
+        std::vector<double> s(3 + 2 * channels, 0.0);
+        for (const auto &block : sums)
+            for (size_t j = 0; j < s.size(); ++j)
+                s[j] += block[j];
+
+        d.proxy.diffuse = d.proxy.specular = zero();
+        for (size_t ch = 0; ch < channels; ++ch) {
+            double b0 = s[3 + ch], b1 = s[3 + channels + ch],
+                   det = s[0] * s[2] - s[1] * s[1],
+                   kd = det != 0 ? (b0 * s[2] - b1 * s[1]) / det : 0.0,
+                   ks = det != 0 ? (b1 * s[0] - b0 * s[1]) / det : 0.0;
+
+            /* Enforce nonnegative weights by refitting a single lobe */
+            if (ks < 0) {
+                kd = s[0] > 0 ? std::max(b0 / s[0], 0.0) : 0.0;
+                ks = 0.0;
+            } else if (kd < 0) {
+                ks = s[2] > 0 ? std::max(b1 / s[2], 0.0) : 0.0;
+                kd = 0.0;
+            }
+
+            d.proxy.diffuse[ch]  = (float) kd;
+            d.proxy.specular[ch] = (float) ks;
+        }
+    });
+
+    return d.proxy;
+}
+
+// *****************************************************************************
+// Material registry
+// *****************************************************************************
+
+template <size_t Channels>
+std::vector<LevelInfo> BasicBRDF<Channels>::levels() const {
+    std::vector<LevelInfo> result;
+    for (const auto &level : m_data->levels)
+        result.push_back(level_info(level));
+    for (const auto &level : m_data->levels_iso)
+        result.push_back(level_info(level));
+    return result;
+}
+
+template <size_t Channels> size_t BasicBRDF<Channels>::memory_usage() const {
+    return m_data->memory_usage();
+}
+
+template <size_t Channels> bool BasicBRDF<Channels>::isotropic() const {
+    return m_data->isotropic;
+}
+
+template <size_t Channels> struct BasicRegistry<Channels>::State {
+    using DataPtr = std::shared_ptr<typename BasicBRDF<Channels>::Data>;
+
+    struct Entry {
+        /// Shared result of the load (permits concurrent requests for the same file)
+        std::shared_future<DataPtr> data;
+
+        /// Position in the LRU list
+        std::list<std::string>::iterator lru;
+
+        /// Number of bytes occupied by the material (zero while loading)
+        size_t bytes = 0;
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+
+    /// Keys of all entries, most recently used first
+    std::list<std::string> lru;
+
+    size_t budget = std::numeric_limits<size_t>::max();
+    size_t resident_bytes = 0;
+
+    /// Evict unreferenced entries until the budget is met (requires 'mutex')
+    void trim() {
+        auto it = lru.end();
+        while (resident_bytes > budget && it != lru.begin()) {
+            auto entry = entries.find(*--it);
+            if (entry->second.bytes == 0 ||
+                entry->second.data.get().use_count() > 1)
+                continue; // still loading or in use
+
+            resident_bytes -= entry->second.bytes;
+            entries.erase(entry);
+            it = lru.erase(it);
+        }
+    }
+};
+
+template <size_t Channels> BasicRegistry<Channels>::BasicRegistry() : m_state(new State()) { }
+template <size_t Channels> BasicRegistry<Channels>::~BasicRegistry() { }
+
+template <size_t Channels> BasicRegistry<Channels> &BasicRegistry<Channels>::instance() {
+    static BasicRegistry registry;
+    return registry;
+}
+
+template <size_t Channels>
+BasicBRDF<Channels> BasicRegistry<Channels>::load(const std::string &path_to_file,
+                                                  const LoadOptions &options) {
+    using DataPtr = typename State::DataPtr;
+
+    /* Materials loaded with different options are tracked separately */
+    std::string key = path_to_file;
+    if (options.slice_cache_size > 0)
+        key += " (slice cache: " + std::to_string(options.slice_cache_size) + " bytes)";
+    if (options.spectral_basis_size > 0)
+        key += " (spectral basis: " + std::to_string(options.spectral_basis_size) + ")";
+    if (options.lod_levels > 0)
+        key += " (levels of detail: " + std::to_string(options.lod_levels) + ")";
+    if (options.numa_replicate)
+        key += " (NUMA replicas)";
+    if (options.memory_resource) {
+        std::ostringstream oss;
+        oss << " (memory resource: " << (const void *) options.memory_resource.get() << ")";
+        key += oss.str();
+    }
+
+    std::unique_lock<std::mutex> guard(m_state->mutex);
+
+    auto it = m_state->entries.find(key);
+    if (it != m_state->entries.end()) {
+        /* Resident or currently being loaded by another thread */
+        m_state->lru.splice(m_state->lru.begin(), m_state->lru, it->second.lru);
+        std::shared_future<DataPtr> data = it->second.data;
+        guard.unlock();
+        return BasicBRDF<Channels>(data.get());
+    }
+
+    std::promise<DataPtr> promise;
+    typename State::Entry &entry = m_state->entries[key];
+    entry.data = promise.get_future().share();
+    entry.lru = m_state->lru.insert(m_state->lru.begin(), key);
+    guard.unlock();
+
+    DataPtr data;
+    try {
+        data = BasicBRDF<Channels>(path_to_file, options).m_data;
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+        guard.lock();
+        it = m_state->entries.find(key);
+        m_state->lru.erase(it->second.lru);
+        m_state->entries.erase(it);
+        throw;
+    }
+    promise.set_value(data);
+
+    guard.lock();
+    size_t bytes = data->memory_usage();
+    m_state->entries[key].bytes = bytes;
+    m_state->resident_bytes += bytes;
+    m_state->trim();
+
+    return BasicBRDF<Channels>(data);
+}
+
+template <size_t Channels> void BasicRegistry<Channels>::set_budget(size_t bytes) {
+    std::lock_guard<std::mutex> guard(m_state->mutex);
+    m_state->budget = bytes;
+    m_state->trim();
+}
+
+template <size_t Channels> size_t BasicRegistry<Channels>::budget() const {
+    std::lock_guard<std::mutex> guard(m_state->mutex);
+    return m_state->budget;
+}
+
+template <size_t Channels> void BasicRegistry<Channels>::trim() {
+    std::lock_guard<std::mutex> guard(m_state->mutex);
+    m_state->trim();
+}
+
+template <size_t Channels> size_t BasicRegistry<Channels>::resident_bytes() const {
+    std::lock_guard<std::mutex> guard(m_state->mutex);
+    return m_state->resident_bytes;
+}
+
+template <size_t Channels>
+std::vector<std::pair<std::string, size_t>> BasicRegistry<Channels>::usage() const {
+    std::lock_guard<std::mutex> guard(m_state->mutex);
+    std::vector<std::pair<std::string, size_t>> result;
+    for (const auto &key : m_state->lru) {
+        const typename State::Entry &entry = m_state->entries.find(key)->second;
+        if (entry.bytes != 0)
+            result.emplace_back(key, entry.bytes);
+    }
+    return result;
+}
+
+// *****************************************************************************
+// Baked lookup table
+// *****************************************************************************
+
+template <size_t Channels> struct BasicBakedBRDF<Channels>::Data {
+    /// Resolution along phi_h, theta_h, theta_d and phi_d
+    uint32_t res[4];
+
+    /// Number of channels
+    uint32_t channels;
+
+    /// Values of f_r * cos, indexed as [phi_h][theta_h][theta_d][phi_d][channel]
+    FloatStorage table;
+
+    /// Approximation error with respect to the full model
+    Error error;
+
+    /// Return the number of channels (a compile-time constant unless Channels == Dynamic)
+    size_t channel_count() const {
+        return Channels != Dynamic ? Channels : channels;
+    }
+};
+
+/// Convert a pair of directions into half/difference angles (Rusinkiewicz)
+static void to_half_diff(const Vector3f &wi, const Vector3f &wo,
+                         float &theta_h, float &phi_h,
+                         float &theta_d, float &phi_d) {
+    Vector3f wh = normalize(wi + wo);
+    theta_h = std::acos(clamp(wh.z(), -1.f, 1.f));
+    phi_h   = std::atan2(wh.y(), wh.x());
+
+    /* Rotate 'wi' into the frame where 'wh' points up */
+    float sin_phi_h = std::sin(phi_h), cos_phi_h = std::cos(phi_h),
+          sin_theta_h = std::sin(theta_h), cos_theta_h = std::cos(theta_h);
+
+    float x = cos_phi_h * wi.x() + sin_phi_h * wi.y(),
+          y = cos_phi_h * wi.y() - sin_phi_h * wi.x();
+
+    Vector3f wd = Vector3f(cos_theta_h * x - sin_theta_h * wi.z(), y,
+                           sin_theta_h * x + cos_theta_h * wi.z());
+
+    theta_d = std::acos(clamp(wd.z(), -1.f, 1.f));
+    phi_d   = std::atan2(wd.y(), wd.x());
+}
+
+/// Inverse of \c to_half_diff()
+static void from_half_diff(float theta_h, float phi_h, float theta_d,
+                           float phi_d, Vector3f &wi, Vector3f &wo) {
+    float sin_theta_d = std::sin(theta_d);
+    Vector3f wd = Vector3f(sin_theta_d * std::cos(phi_d),
+                           sin_theta_d * std::sin(phi_d), std::cos(theta_d));
+
+    float sin_phi_h = std::sin(phi_h), cos_phi_h = std::cos(phi_h),
+          sin_theta_h = std::sin(theta_h), cos_theta_h = std::cos(theta_h);
+
+    float x = cos_theta_h * wd.x() + sin_theta_h * wd.z(),
+          z = cos_theta_h * wd.z() - sin_theta_h * wd.x();
+
+    wi = Vector3f(cos_phi_h * x - sin_phi_h * wd.y(),
+                  sin_phi_h * x + cos_phi_h * wd.y(), z);
+
+    Vector3f wh = Vector3f(sin_theta_h * cos_phi_h, sin_theta_h * sin_phi_h,
+                           cos_theta_h);
+    wo = wh * 2.f * dot(wh, wi) - wi;
+}
+
+template <size_t Channels>
+BasicBakedBRDF<Channels>::BasicBakedBRDF(const BasicBRDF<Channels> &brdf,
+                                         uint32_t res_theta_h, uint32_t res_theta_d,
+                                         uint32_t res_phi_d, uint32_t res_phi_h,
+                                         uint32_t error_samples)
+    : m_data(std::make_shared<Data>()) {
+    if (res_phi_h == 0)
+        res_phi_h = brdf.isotropic() ? 1 : 16;
+
+    if (res_theta_h < 2 || res_theta_d < 2 || res_phi_d < 1)
+        throw std::runtime_error("BakedBRDF: invalid resolution!");
+
+    Data &d = *m_data;
+    d.res[0] = res_phi_h;
+    d.res[1] = res_theta_h;
+    d.res[2] = res_theta_d;
+    d.res[3] = res_phi_d;
+    d.channels = (uint32_t) brdf.channels();
+
+    const size_t channels = d.channel_count();
+    d.table = FloatStorage((size_t) res_phi_h * res_theta_h * res_theta_d *
+                           res_phi_d * channels);
+
+    /* Tabulate the BRDF, one (phi_h, theta_h) row at a time */
+    parallel_for(res_phi_h * res_theta_h, [&](size_t row) {
+        uint32_t i_phi_h = (uint32_t) row / res_theta_h,
+                 i_theta_h = (uint32_t) row % res_theta_h;
+
+        /* theta_h is discretized like theta2u() to refine the specular peak */
+        float phi_h = 2.f * Pi * i_phi_h / res_phi_h,
+              theta_h = u2theta(i_theta_h / float(res_theta_h - 1));
+
+        float *out = d.table.data() + row * res_theta_d * res_phi_d * channels;
+        for (uint32_t i_theta_d = 0; i_theta_d < res_theta_d; ++i_theta_d) {
+            float theta_d = (.5f * Pi) * i_theta_d / (res_theta_d - 1);
+
+            for (uint32_t i_phi_d = 0; i_phi_d < res_phi_d; ++i_phi_d) {
+                float phi_d = 2.f * Pi * i_phi_d / res_phi_d;
+
+                Vector3f wi, wo;
+                from_half_diff(theta_h, phi_h, theta_d, phi_d, wi, wo);
+
+                Color<Channels> value = brdf.eval(wi, wo);
+                for (size_t ch = 0; ch < channels; ++ch)
+                    *out++ = value[ch];
+            }
+        }
+    });
+
+    /* Estimate the approximation error using random pairs of directions */
+    const uint32_t block_size = 1024;
+    uint32_t blocks = (error_samples + block_size - 1) / block_size;
+    std::vector<Color<Channels>> max_error(blocks, zero_color<Channels>(channels)),
+                                 sum_sqr_error(blocks, zero_color<Channels>(channels));
+
+    parallel_for(blocks, [&](size_t block) {
+        std::mt19937 rng((uint32_t) block);
+        std::uniform_real_distribution<float> dist(0.f, 1.f);
+
+        auto sample_hemisphere = [&]() {
+            float z = dist(rng), phi = 2.f * Pi * dist(rng),
+                  r = std::sqrt(std::max(0.f, 1.f - z * z));
+            return Vector3f(r * std::cos(phi), r * std::sin(phi), z);
+        };
+
+        uint32_t count = std::min(block_size, error_samples - (uint32_t) block * block_size);
+        for (uint32_t i = 0; i < count; ++i) {
+            Vector3f wi = sample_hemisphere(), wo = sample_hemisphere();
+            Color<Channels> diff = eval(wi, wo) - brdf.eval(wi, wo);
+
+            for (size_t ch = 0; ch < channels; ++ch) {
+                max_error[block][ch] = std::max(max_error[block][ch], std::abs(diff[ch]));
+                sum_sqr_error[block][ch] += sqr(diff[ch]);
+            }
+        }
+    });
+
+    d.error.max_error = zero_color<Channels>(channels);
+    d.error.rms_error = zero_color<Channels>(channels);
+    for (uint32_t i = 0; i < blocks; ++i) {
+        for (size_t ch = 0; ch < channels; ++ch) {
+            d.error.max_error[ch] = std::max(d.error.max_error[ch], max_error[i][ch]);
+            d.error.rms_error[ch] += sum_sqr_error[i][ch];
+        }
+    }
+    for (size_t ch = 0; ch < channels; ++ch)
+        d.error.rms_error[ch] = std::sqrt(d.error.rms_error[ch] / std::max(error_samples, 1u));
+}
+
+template <size_t Channels>
+Color<Channels> BasicBakedBRDF<Channels>::eval(const Vector3f &wi, const Vector3f &wo) const {
+    const Data &d = *m_data;
+    const size_t channels = d.channel_count();
+
+    Color<Channels> result = zero_color<Channels>(channels);
+    if (wi.z() <= 0 || wo.z() <= 0)
+        return result;
+
+    float theta_h, phi_h, theta_d, phi_d;
+    to_half_diff(wi, wo, theta_h, phi_h, theta_d, phi_d);
+
+    /* Continuous grid positions along each dimension */
+    float pos[4] = {
+        phi_h * (.5f / Pi) * d.res[0],
+        theta2u(theta_h) * (d.res[1] - 1),
+        theta_d * (2.f / Pi) * (d.res[2] - 1),
+        phi_d * (.5f / Pi) * d.res[3]
+    };
+
+    uint32_t index[4][2];
+    float weight[4][2];
+    for (int dim = 0; dim < 4; ++dim) {
+        int32_t res = (int32_t) d.res[dim];
+        float p = pos[dim];
+
+        if (dim == 0 || dim == 3) {
+            /* The azimuths are periodic */
+            float p0 = std::floor(p);
+            int32_t i0 = ((int32_t) p0 % res + res) % res;
+            index[dim][0] = (uint32_t) i0;
+            index[dim][1] = (uint32_t) ((i0 + 1) % res);
+            weight[dim][1] = p - p0;
+        } else {
+            int32_t i0 = clamp((int32_t) p, 0, res - 2);
+            index[dim][0] = (uint32_t) i0;
+            index[dim][1] = (uint32_t) (i0 + 1);
+            weight[dim][1] = clamp(p - (float) i0, 0.f, 1.f);
+        }
+        weight[dim][0] = 1.f - weight[dim][1];
+    }
+
+    /* Quadrilinear interpolation (trilinear for isotropic materials) */
+    uint32_t n_phi_h = d.res[0] > 1 ? 2 : 1;
+    for (uint32_t a = 0; a < n_phi_h; ++a) {
+        for (uint32_t b = 0; b < 2; ++b) {
+            for (uint32_t c = 0; c < 2; ++c) {
+                float w_abc = (n_phi_h > 1 ? weight[0][a] : 1.f) *
+                              weight[1][b] * weight[2][c];
+                size_t base = (((size_t) index[0][a] * d.res[1] + index[1][b]) *
+                               d.res[2] + index[2][c]) * d.res[3];
+
+                for (uint32_t e = 0; e < 2; ++e) {
+                    float w = w_abc * weight[3][e];
+                    const float *v = d.table.data() + (base + index[3][e]) * channels;
+                    for (size_t ch = 0; ch < channels; ++ch)
+                        result[ch] = std::fma(w, v[ch], result[ch]);
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+template <size_t Channels>
+const typename BasicBakedBRDF<Channels>::Error &BasicBakedBRDF<Channels>::error() const {
+    return m_data->error;
+}
+
+template <size_t Channels> size_t BasicBakedBRDF<Channels>::memory_usage() const {
+    return sizeof(Data) + m_data->table.size() * sizeof(float);
+}
+
+// *****************************************************************************
+// Explicit instantiations
+// *****************************************************************************
+
+template struct BasicProxy<1>;
+template struct BasicProxy<3>;
+template struct BasicProxy<Dynamic>;
+template class BasicBRDF<1>;
+template class BasicBRDF<3>;
+template class BasicBRDF<Dynamic>;
+template class BasicBoundBRDF<1>;
+template class BasicBoundBRDF<3>;
+template class BasicBoundBRDF<Dynamic>;
+template class BasicReloadableBRDF<1>;
+template class BasicReloadableBRDF<3>;
+template class BasicReloadableBRDF<Dynamic>;
+template class BasicRegistry<1>;
+template class BasicRegistry<3>;
+template class BasicRegistry<Dynamic>;
+template class BasicBakedBRDF<1>;
+template class BasicBakedBRDF<3>;
+template class BasicBakedBRDF<Dynamic>;
+
 POWITACQ_NAMESPACE_END
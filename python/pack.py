@@ -0,0 +1,114 @@
+"""
+Bundle a directory of .bsdf files into a single material pack.
+
+A pack begins with a small index that maps entry names (the file names
+without the .bsdf extension) to the location of the corresponding tensor
+file, which is stored verbatim. The C++ implementation memory-maps the pack
+once and loads entries via BRDF(Pack(filename), name).
+
+File layout (little endian):
+
+    char[12]  "tensor_pack\\0"
+    uint8[2]  version (1, 0)
+    uint32    number of entries
+    per entry:
+        uint16    name length
+        char[]    name (UTF-8)
+        uint64    offset of the tensor file (from the start of the pack)
+        uint64    size of the tensor file in bytes
+    tensor files, each starting at an offset aligned to 'align' bytes
+
+Usage: python pack.py <directory> <output.pack>
+"""
+
+import struct
+import os
+import sys
+
+
+def size_fmt(num, suffix='B'):
+    for unit in ['', 'Ki', 'Mi', 'Gi', 'Ti', 'Pi']:
+        if abs(num) < 1024.0:
+            return "%3.1f %s%s" % (num, unit, suffix)
+        num /= 1024.0
+    return "%.1f %s%s" % (num, 'Yi', suffix)
+
+
+def write_pack(filename, files, align=64):
+    """ Write a pack containing the given {name: path} mapping """
+    names = sorted(files.keys())
+    labels = [name.encode('utf8') for name in names]
+    sizes = [os.stat(files[name]).st_size for name in names]
+
+    # Compute the size of the index and the entry offsets
+    pos = 12 + 2 + 4 + sum(2 + len(label) + 8 + 8 for label in labels)
+    offsets = []
+    for size in sizes:
+        pos = (pos + align - 1) // align * align
+        offsets.append(pos)
+        pos += size
+
+    with open(filename, 'wb') as f:
+        # Identifier
+        f.write('tensor_pack\0'.encode('utf8'))
+
+        # Version number
+        f.write(struct.pack('<BB', 1, 0))
+
+        # Number of entries
+        f.write(struct.pack('<I', len(names)))
+
+        # Index
+        for label, offset, size in zip(labels, offsets, sizes):
+            f.write(struct.pack('<H', len(label)))
+            f.write(label)
+            f.write(struct.pack('<QQ', offset, size))
+
+        # Tensor files
+        for name, offset in zip(names, offsets):
+            f.write(b'\0' * (offset - f.tell()))
+            with open(files[name], 'rb') as src:
+                while True:
+                    chunk = src.read(1 << 24)
+                    if not chunk:
+                        break
+                    f.write(chunk)
+
+        print('Wrote \"%s\" (%s, %i entries)' % (filename, size_fmt(f.tell()),
+                                                 len(names)))
+
+
+def read_pack_index(filename):
+    """ Return a {name: (offset, size)} mapping describing a pack's contents """
+    with open(filename, 'rb') as f:
+        def unpack(fmt):
+            result = struct.unpack(fmt, f.read(struct.calcsize(fmt)))
+            return result if len(result) > 1 else result[0]
+
+        if f.read(12) != 'tensor_pack\0'.encode('utf8'):
+            raise Exception('Invalid pack file (header not recognized)')
+
+        if unpack('<BB') != (1, 0):
+            raise Exception('Invalid pack file (unrecognized '
+                            'file format version)')
+
+        index = {}
+        for i in range(unpack('<I')):
+            name = f.read(unpack('<H')).decode('utf8')
+            index[name] = unpack('<QQ')
+    return index
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        print('Usage: python pack.py <directory> <output.pack>')
+        sys.exit(1)
+
+    directory = sys.argv[1]
+    files = {}
+    for entry in os.listdir(directory):
+        name, ext = os.path.splitext(entry)
+        if ext == '.bsdf':
+            files[name] = os.path.join(directory, entry)
+
+    write_pack(sys.argv[2], files)
@@ -0,0 +1,124 @@
+"""
+Convert a spectral .bsdf file into an RGB .bsdf file that can be loaded by
+powitacq_rgb::BRDF.
+
+The 'spectra' field is integrated against the CIE 1931 color matching
+functions (using the analytic multi-lobe fits of Wyman et al., "Simple
+Analytic Approximations to the CIE XYZ Color Matching Functions", JCGT 2013)
+and then transformed into linear sRGB, producing the 'rgb' field. The
+spectral samples are linearly interpolated in wavelength, and a Bradford
+transform adapts the equal-energy white point of reflectance spectra to D65,
+so that a constant unit spectrum maps to (approximately) RGB white. Since BRDF
+evaluation interpolates the tabulated values linearly, the RGB file reproduces
+the color of the spectral one up to clipping of out-of-gamut values.
+
+All other fields are copied verbatim. The slices associated with the
+individual incident directions are converted in parallel.
+
+Usage: python spectral_to_rgb.py <input.bsdf> <output.bsdf>
+"""
+
+import numpy as np
+import os
+import sys
+from concurrent.futures import ThreadPoolExecutor
+
+from visualize import read_tensor, write_tensor
+
+
+# Linear sRGB primaries, D65 white point
+XYZ_TO_SRGB = np.array([
+    [ 3.2404542, -1.5371385, -0.4985314],
+    [-0.9692660,  1.8760108,  0.0415560],
+    [ 0.0556434, -0.2040259,  1.0572252]
+])
+
+# Bradford cone response matrix
+BRADFORD = np.array([
+    [ 0.8951,  0.2664, -0.1614],
+    [-0.7502,  1.7135,  0.0367],
+    [ 0.0389, -0.0685,  1.0296]
+])
+
+
+def chromatic_adaptation(src_white, dst_white):
+    """ Bradford transform between two XYZ white points """
+    scale = (BRADFORD @ dst_white) / (BRADFORD @ src_white)
+    return np.linalg.inv(BRADFORD) @ np.diag(scale) @ BRADFORD
+
+
+def cie_1931(wavelengths):
+    """ Evaluate the CIE 1931 2 degree color matching functions """
+    def g(x, mu, sigma1, sigma2):
+        t = (x - mu) / np.where(x < mu, sigma1, sigma2)
+        return np.exp(-0.5 * t * t)
+
+    x = 1.056 * g(wavelengths, 599.8, 37.9, 31.0) + \
+        0.362 * g(wavelengths, 442.0, 16.0, 26.7) - \
+        0.065 * g(wavelengths, 501.1, 20.4, 26.2)
+    y = 0.821 * g(wavelengths, 568.8, 46.9, 40.5) + \
+        0.286 * g(wavelengths, 530.9, 16.3, 31.1)
+    z = 1.217 * g(wavelengths, 437.0, 11.8, 36.0) + \
+        0.681 * g(wavelengths, 459.0, 26.0, 13.8)
+    return np.stack([x, y, z])
+
+
+def spectral_to_rgb_weights(wavelengths, lambda_min=360, lambda_max=830):
+    """
+    Return a 3xN matrix that maps N spectral samples at the given wavelengths
+    (in nanometers) to linear sRGB
+    """
+    fine = np.linspace(lambda_min, lambda_max,
+                       (lambda_max - lambda_min) * 4 + 1)
+    cmf = cie_1931(fine)
+
+    # Piecewise linear reconstruction of each spectral sample
+    basis = np.stack([np.interp(fine, wavelengths, e)
+                      for e in np.eye(len(wavelengths))])
+
+    # Trapezoidal rule
+    quad = np.full(fine.shape, fine[1] - fine[0])
+    quad[[0, -1]] *= 0.5
+
+    xyz = (cmf * quad) @ basis.T
+    xyz /= np.sum(cmf[1] * quad)
+
+    # Adapt the equal-energy white of reflectance spectra to D65
+    adapt = chromatic_adaptation(np.ones(3), np.array([0.95047, 1.0, 1.08883]))
+
+    return XYZ_TO_SRGB @ adapt @ xyz
+
+
+def convert(tensor, workers=None):
+    """ Convert the fields of a spectral tensor file into those of an RGB one """
+    if 'spectra' not in tensor or 'wavelengths' not in tensor:
+        raise Exception('Input is not a spectral material file')
+
+    spectra = tensor['spectra']
+    weights = spectral_to_rgb_weights(tensor['wavelengths'].astype(np.float64))
+    rgb = np.empty(spectra.shape[:2] + (3,) + spectra.shape[3:],
+                   dtype=np.float32)
+
+    def convert_slice(index):
+        i, j = divmod(index, spectra.shape[1])
+        rgb[i, j] = np.tensordot(weights, spectra[i, j], axes=1)
+
+    with ThreadPoolExecutor(max_workers=workers or os.cpu_count()) as pool:
+        list(pool.map(convert_slice,
+                      range(spectra.shape[0] * spectra.shape[1])))
+
+    result = {}
+    for k, v in tensor.items():
+        if k == 'spectra':
+            result['rgb'] = rgb
+        elif k != 'wavelengths':
+            result[k] = v
+    return result
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        print('Usage: python spectral_to_rgb.py <input.bsdf> <output.bsdf>')
+        sys.exit(1)
+
+    write_tensor(sys.argv[2], **convert(read_tensor(sys.argv[1])))
@@ -62,7 +62,7 @@ def read_tensor(filename):
     return result
 
 
-def write_tensor(filename, align=8, **kwargs):
+def write_tensor(filename, align=64, **kwargs):
     with open(filename, 'wb') as f:
         # Identifier
         f.write('tensor_file\0'.encode('utf8'))
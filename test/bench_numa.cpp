@@ -0,0 +1,58 @@
+#define POWITACQ_IMPLEMENTATION
+#include "powitacq.h"
+#include <chrono>
+#include <random>
+#include <thread>
+
+using namespace powitacq;
+
+/* Evaluate 'queries' random pairs of directions on each of 'threads' threads
+   and return the total throughput in million queries per second */
+static double throughput(const BRDF &brdf, uint32_t threads, size_t queries) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&brdf, queries, t]() {
+            std::mt19937 rng(t);
+            std::uniform_real_distribution<float> uniform;
+            float sum = 0.f;
+            for (size_t i = 0; i < queries; ++i) {
+                Vector3f wi = normalize(Vector3f(uniform(rng) - .5f, uniform(rng) - .5f, 1.f)),
+                         wo = normalize(Vector3f(uniform(rng) - .5f, uniform(rng) - .5f, 1.f));
+                sum += brdf.eval(wi, wo)[0];
+            }
+            volatile float sink = sum;
+            (void) sink;
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    return threads * queries / seconds * 1e-6;
+}
+
+int main(int argc, char **argv) {
+    const char *filename = argc > 1 ? argv[1] : "cc_ibiza_sunset_spec.bsdf";
+    const size_t queries = 200000;
+    uint32_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // load the BRDF with and without replicated tables
+    LoadOptions options;
+    BRDF brdf(filename, options);
+    options.numa_replicate = true;
+    BRDF replicated(filename, options);
+
+    printf("%u NUMA node(s), %u hardware threads\n",
+           NumaTopology::instance().node_count(), max_threads);
+    printf("threads | shared (Mq/s) | replicated (Mq/s)\n");
+    for (uint32_t threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+        printf("%7u | %13.2f | %17.2f\n", threads,
+               throughput(brdf, threads, queries),
+               throughput(replicated, threads, queries));
+        if (threads == max_threads)
+            break;
+    }
+}
@@ -0,0 +1,75 @@
+#define POWITACQ_IMPLEMENTATION
+#include "powitacq.h"
+#include <chrono>
+#include <random>
+
+using namespace powitacq;
+
+using Clock = std::chrono::steady_clock;
+
+/* Read a buffer larger than the last-level cache, which evicts the tables
+   like the shading work of a wavefront renderer between two batches */
+static float evict(const std::vector<float> &buffer) {
+    float sum = 0.f;
+    for (size_t i = 0; i < buffer.size(); i += 16)
+        sum += buffer[i];
+    return sum;
+}
+
+/* Independent work that the prefetches can overlap with */
+static float shade(float value) {
+    for (int i = 0; i < 2000; ++i)
+        value = value * 0.999f + 0.001f;
+    return value;
+}
+
+/* Sample 'batches' batches of 'batch' random incident directions, where each
+   batch starts with cold caches. Return the average latency of a query in
+   nanoseconds, and the time spent in prefetch() per query in 'prefetch_ns' */
+static double latency(const BRDF &brdf, bool prefetch, size_t batches, size_t batch,
+                      double &prefetch_ns) {
+    std::vector<float> buffer(64 * 1024 * 1024 / sizeof(float), 1.f);
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> uniform;
+    std::vector<Vector3f> wi(batch);
+    double query_seconds = 0.0, prefetch_seconds = 0.0;
+    float sum = 0.f;
+
+    for (size_t k = 0; k < batches; ++k) {
+        for (size_t i = 0; i < batch; ++i)
+            wi[i] = normalize(Vector3f(uniform(rng) - .5f, uniform(rng) - .5f, 1.f));
+        sum += evict(buffer);
+
+        auto start = Clock::now();
+        if (prefetch)
+            brdf.prefetch(batch, wi.data());
+        prefetch_seconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+        sum = shade(sum);
+
+        start = Clock::now();
+        for (size_t i = 0; i < batch; ++i)
+            sum += brdf.sample(Vector2f(uniform(rng), uniform(rng)), wi[i])[0];
+        query_seconds += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    volatile float sink = sum;
+    (void) sink;
+    prefetch_ns = prefetch_seconds / (batches * batch) * 1e9;
+    return query_seconds / (batches * batch) * 1e9;
+}
+
+int main(int argc, char **argv) {
+    const char *filename = argc > 1 ? argv[1] : "cc_ibiza_sunset_spec.bsdf";
+    const size_t batches = 200;
+
+    BRDF brdf(filename);
+
+    printf("batch | sample, cold (ns) | sample, prefetched (ns) | prefetch() (ns)\n");
+    for (size_t batch = 1; batch <= 256; batch *= 4) {
+        double unused, prefetch_ns;
+        double cold = latency(brdf, false, batches, batch, unused),
+               warm = latency(brdf, true, batches, batch, prefetch_ns);
+        printf("%5zu | %17.1f | %23.1f | %15.1f\n", batch, cold, warm, prefetch_ns);
+    }
+}
@@ -0,0 +1,62 @@
+#define POWITACQ_IMPLEMENTATION
+#include "powitacq.h"
+#include <chrono>
+#include <random>
+#include <thread>
+
+using namespace powitacq;
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+    const char *filename = argc > 1 ? argv[1] : "cc_ibiza_sunset_spec.bsdf";
+    const size_t count = 1 << 20;
+
+    BRDF brdf(filename);
+    size_t channels = brdf.channels();
+
+    // queries in path order, i.e. with unrelated incident directions
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> uniform;
+    std::vector<Vector3f> wi(count), wo(count);
+    std::vector<Vector2f> u(count);
+    for (size_t i = 0; i < count; ++i) {
+        wi[i] = normalize(Vector3f(uniform(rng) - .5f, uniform(rng) - .5f, uniform(rng)));
+        wo[i] = normalize(Vector3f(uniform(rng) - .5f, uniform(rng) - .5f, uniform(rng)));
+        u[i] = Vector2f(uniform(rng), uniform(rng));
+    }
+    std::vector<float> out(count * channels), pdf(count);
+    std::vector<Vector3f> wo_sampled(count);
+
+    printf("%zu queries, %zu channels\n", count, channels);
+    printf("query       | threads | unsorted (ms) | sorted (ms) | sort (ms) | speedup\n");
+    for (uint32_t threads : { 1u, 0u }) {
+        for (int query = 0; query < 2; ++query) {
+            double total[2], sort_seconds = 0.0;
+            for (int sort = 0; sort < 2; ++sort) {
+                BulkOptions options;
+                options.threads = threads;
+                options.sort = sort != 0;
+                options.sort_seconds = &sort_seconds;
+
+                auto start = Clock::now();
+                if (query == 0)
+                    brdf.eval_bulk(count, wi.data(), wo.data(), out.data(), options);
+                else
+                    brdf.sample_bulk(count, u.data(), wi.data(), wo_sampled.data(),
+                                     pdf.data(), out.data(), options);
+                total[sort] = seconds_since(start);
+            }
+
+            printf("%-11s | %7u | %13.1f | %11.1f | %9.1f | %6.2fx\n",
+                   query == 0 ? "eval_bulk" : "sample_bulk",
+                   threads ? threads : std::thread::hardware_concurrency(),
+                   total[0] * 1e3, total[1] * 1e3, sort_seconds * 1e3,
+                   total[0] / total[1]);
+        }
+    }
+}
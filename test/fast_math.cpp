@@ -0,0 +1,80 @@
+#define POWITACQ_IMPLEMENTATION
+#include "powitacq.h"
+#include <random>
+
+/* Defined in fast_math_impl.cpp */
+void fast_eval_pdf(const char *filename, size_t count, const float *wi,
+                   const float *wo, float *value, float *pdf);
+
+/* Relative errors are measured with respect to values above this fraction of
+   the largest reference value, which excludes the near-zero tails */
+static const float RelativeThreshold = 1e-3f;
+
+struct Error {
+    float max_abs = 0.f, max_rel = 0.f;
+
+    void update(float value, float ref, float peak) {
+        float err = std::abs(value - ref);
+        max_abs = std::max(max_abs, err);
+        if (std::abs(ref) > RelativeThreshold * peak)
+            max_rel = std::max(max_rel, err / std::abs(ref));
+    }
+};
+
+int main(int argc, char **argv) {
+    using namespace powitacq;
+
+    const char *filename = argc > 1 ? argv[1] : "cc_ibiza_sunset_spec.bsdf";
+    const size_t count = 100000;
+
+    // sample pairs of directions in the upper hemisphere
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform;
+    std::vector<float> wi(3 * count), wo(3 * count);
+    for (size_t i = 0; i < 2 * count; ++i) {
+        float *w = (i < count ? wi.data() : wo.data()) + 3 * (i % count);
+        float cos_theta = uniform(rng), phi = 2.f * Pi * uniform(rng),
+              sin_theta = std::sqrt(1.f - cos_theta * cos_theta);
+        w[0] = std::cos(phi) * sin_theta;
+        w[1] = std::sin(phi) * sin_theta;
+        w[2] = cos_theta;
+    }
+
+    // evaluate the precise implementation
+    BRDF brdf(filename);
+    size_t channels = brdf.channels();
+    std::vector<float> value(count * channels), pdf(count);
+    float value_peak = 0.f, pdf_peak = 0.f;
+    for (size_t i = 0; i < count; ++i) {
+        Vector3f wi_i(wi[3 * i], wi[3 * i + 1], wi[3 * i + 2]),
+                 wo_i(wo[3 * i], wo[3 * i + 1], wo[3 * i + 2]);
+        Spectrum fr = brdf.eval(wi_i, wo_i);
+        for (size_t ch = 0; ch < channels; ++ch) {
+            value[i * channels + ch] = fr[ch];
+            value_peak = std::max(value_peak, std::abs(fr[ch]));
+        }
+        pdf[i] = brdf.pdf(wi_i, wo_i);
+        pdf_peak = std::max(pdf_peak, pdf[i]);
+    }
+
+    // evaluate the fast-math implementation
+    std::vector<float> value_fast(count * channels), pdf_fast(count);
+    fast_eval_pdf(filename, count, wi.data(), wo.data(), value_fast.data(),
+                  pdf_fast.data());
+
+    Error value_error, pdf_error;
+    for (size_t i = 0; i < count * channels; ++i)
+        value_error.update(value_fast[i], value[i], value_peak);
+    for (size_t i = 0; i < count; ++i)
+        pdf_error.update(pdf_fast[i], pdf[i], pdf_peak);
+
+    /* print values to console */
+    printf("eval: max. abs. error %g, max. rel. error %g\n",
+           value_error.max_abs, value_error.max_rel);
+    printf("pdf:  max. abs. error %g, max. rel. error %g\n",
+           pdf_error.max_abs, pdf_error.max_rel);
+
+    bool success = value_error.max_rel < 1e-3f && pdf_error.max_rel < 1e-3f;
+    printf("%s\n", success ? "passed" : "FAILED");
+    return success ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+/* Second copy of the implementation with POWITACQ_FAST_MATH enabled, placed
+   in its own namespace so that it can be compared against the precise one */
+#define POWITACQ_NAMESPACE_BEGIN namespace powitacq_fast {
+#define POWITACQ_NAMESPACE_END   }
+#define POWITACQ_FAST_MATH 1
+#define POWITACQ_IMPLEMENTATION
+#include "powitacq.h"
+
+void fast_eval_pdf(const char *filename, size_t count, const float *wi,
+                   const float *wo, float *value, float *pdf) {
+    using namespace powitacq_fast;
+
+    BRDF brdf(filename);
+    size_t channels = brdf.channels();
+    for (size_t i = 0; i < count; ++i) {
+        Vector3f wi_i(wi[3 * i], wi[3 * i + 1], wi[3 * i + 2]),
+                 wo_i(wo[3 * i], wo[3 * i + 1], wo[3 * i + 2]);
+        Spectrum fr = brdf.eval(wi_i, wo_i);
+        for (size_t ch = 0; ch < channels; ++ch)
+            value[i * channels + ch] = fr[ch];
+        pdf[i] = brdf.pdf(wi_i, wo_i);
+    }
+}